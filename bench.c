@@ -0,0 +1,521 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include "huffman.h"
+
+#define BENCH_SEED 0x9E3779B97F4A7C15ull
+#define BENCH_SIZE (16u << 20)
+#define BENCH_RUNS 5
+#define BENCH_WARMUP_RUNS 1
+#define ZIPF_EXPONENT 1.1
+
+typedef struct benchCorpus benchCorpus;
+typedef struct benchStats benchStats;
+
+/*
+Every corpus is generated from a fixed seed, so all runs on all machines
+measure the same bytes.
+*/
+struct benchCorpus {
+    const char *name;
+    void (*generate)(uint8_t*, size_t, uint64_t*);
+};
+
+struct benchStats {
+    double mean;
+    double stddev;
+    double min;
+    double max;
+};
+
+static uint64_t nextRandom(uint64_t*);
+static void generateUniform(uint8_t*, size_t, uint64_t*);
+static void generateZipf(uint8_t*, size_t, uint64_t*);
+static void generateText(uint8_t*, size_t, uint64_t*);
+static void generateLog(uint8_t*, size_t, uint64_t*);
+static void generateOneByte(uint8_t*, size_t, uint64_t*);
+static void generateSparse(uint8_t*, size_t, uint64_t*);
+static size_t appendString(uint8_t*, size_t, size_t, const char*);
+static double wallTime(void);
+static void summarize(const double*, uint32_t, double, benchStats*);
+static bool writeFile(const char*, const uint8_t*, size_t);
+static bool readFile(const char*, uint8_t*, size_t, size_t*);
+static bool benchBuffer(ARCH*, const benchCorpus*, const uint8_t*, size_t, uint32_t, FILE*);
+static bool benchFile(ARCH*, const benchCorpus*, const uint8_t*, size_t, uint32_t, FILE*);
+static void report(FILE*, const char*, const char*, uint32_t, size_t, size_t, uint32_t,
+                   const benchStats*, const benchStats*);
+
+static const benchCorpus corpora[] = {
+    {"uniform", generateUniform},
+    {"zipf", generateZipf},
+    {"text", generateText},
+    {"log", generateLog},
+    {"one_byte", generateOneByte},
+    {"sparse", generateSparse}
+};
+
+static const char *words[] = {
+    "the", "of", "and", "to", "a", "in", "is", "it", "that", "was", "he", "for", "on", "are", "as",
+    "with", "his", "they", "at", "be", "this", "from", "have", "or", "by", "one", "had", "not",
+    "but", "what", "all", "were", "when", "we", "there", "can", "an", "your", "which", "their",
+    "said", "if", "do", "will", "each", "about", "how", "up", "out", "them", "then", "she", "many",
+    "some", "so", "these", "would", "other", "into", "has", "more", "her", "two", "like", "him",
+    "see", "time", "could", "no", "make", "than", "first", "been", "its", "who", "now", "people",
+    "my", "made", "over", "did", "down", "only", "way", "find", "use", "may", "water", "long",
+    "little", "very", "after", "words", "called", "just", "where", "most", "know", "through",
+    "archive", "before", "between", "compression", "country", "during", "evening", "government",
+    "however", "language", "letter", "morning", "mountain", "nothing", "question", "remember",
+    "something", "sometimes", "together", "without", "another", "important", "children"
+};
+
+static const char *levels[] = {"INFO", "INFO", "INFO", "DEBUG", "WARN", "ERROR"};
+static const char *paths[] = {"/api/v1/items", "/api/v1/users", "/health", "/api/v2/orders", "/static/app.js"};
+
+/*
+splitmix64: tiny, fast and good enough for test data.
+*/
+static uint64_t nextRandom(uint64_t* state) {
+    uint64_t z = (*state += BENCH_SEED);
+
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+
+    return z ^ (z >> 31);
+}
+
+static void generateUniform(uint8_t* buff, size_t length, uint64_t* state) {
+    uint64_t value;
+    size_t i;
+
+    for (i = 0; i + sizeof(uint64_t) <= length; i += sizeof(uint64_t)) {
+        value = nextRandom(state);
+        memcpy(buff + i, &value, sizeof(uint64_t));
+    }
+
+    for (; i < length; ++i) {
+        buff[i] = (uint8_t)nextRandom(state);
+    }
+}
+
+/*
+Byte values are drawn with probabilities proportional to 1 / rank^s, and
+the ranks are shuffled over the byte values so the skew is not a run of
+neighbouring values.
+*/
+static void generateZipf(uint8_t* buff, size_t length, uint64_t* state) {
+    double cumulative[256];
+    double total = 0.0;
+    uint8_t symbols[256];
+    uint32_t low, high, middle, i, j;
+    uint8_t swap;
+    double sample;
+
+    for (i = 0; i < 256; ++i) {
+        total += 1.0 / pow((double)(i + 1), ZIPF_EXPONENT);
+        cumulative[i] = total;
+        symbols[i] = (uint8_t)i;
+    }
+
+    for (i = 255; i > 0; --i) {
+        j = (uint32_t)(nextRandom(state) % (i + 1));
+        swap = symbols[i];
+        symbols[i] = symbols[j];
+        symbols[j] = swap;
+    }
+
+    for (size_t k = 0; k < length; ++k) {
+        sample = (double)(nextRandom(state) >> 11) / (double)(1ull << 53) * total;
+
+        for (low = 0, high = 255; low < high;) {
+            middle = (low + high) / 2;
+
+            if (cumulative[middle] < sample) {
+                low = middle + 1;
+            } else {
+                high = middle;
+            }
+        }
+
+        buff[k] = symbols[low];
+    }
+}
+
+static size_t appendString(uint8_t* buff, size_t length, size_t position, const char* string) {
+    size_t size = strlen(string);
+
+    if (size > length - position) {
+        size = length - position;
+    }
+
+    memcpy(buff + position, string, size);
+
+    return position + size;
+}
+
+/*
+English-like prose: words drawn with a bias towards the common ones at the
+front of the list, sentences with capitals and punctuation, and
+paragraphs.
+*/
+static void generateText(uint8_t* buff, size_t length, uint64_t* state) {
+    uint32_t numberOfWords = sizeof(words) / sizeof(words[0]);
+    uint32_t wordInSentence = 0;
+    uint64_t random;
+    size_t position = 0;
+    size_t start;
+
+    while (position < length) {
+        random = nextRandom(state);
+        start = position;
+        /* the product of two uniform ranks favours small ones */
+        position = appendString(buff, length, position,
+                                words[(random % numberOfWords) * ((random >> 16) % numberOfWords) / numberOfWords]);
+
+        if (wordInSentence++ == 0 && start < length) {
+            buff[start] = (uint8_t)(buff[start] - 'a' + 'A');
+        }
+
+        if ((random >> 32) % 12 == 0) {
+            position = appendString(buff, length, position, ((random >> 40) % 4 == 0) ? ".\n\n" : ". ");
+            wordInSentence = 0;
+        } else {
+            position = appendString(buff, length, position, ((random >> 40) % 9 == 0) ? ", " : " ");
+        }
+    }
+}
+
+/*
+Lines of a service log: mostly repeated structure with timestamps, hex
+request ids and numbers in between.
+*/
+static void generateLog(uint8_t* buff, size_t length, uint64_t* state) {
+    char line[256];
+    uint64_t random;
+    uint64_t milliseconds = 0;
+    size_t position = 0;
+
+    while (position < length) {
+        random = nextRandom(state);
+        milliseconds += random % 50;
+
+        snprintf(line, sizeof(line),
+                 "2024-03-%02u %02u:%02u:%02u.%03u %-5s [worker-%u] request id=%08x%08x path=%s/%u status=%u latency=%ums\n",
+                 (unsigned)(1 + milliseconds / 86400000 % 28), (unsigned)(milliseconds / 3600000 % 24),
+                 (unsigned)(milliseconds / 60000 % 60), (unsigned)(milliseconds / 1000 % 60),
+                 (unsigned)(milliseconds % 1000), levels[(random >> 8) % 6], (unsigned)((random >> 12) % 8),
+                 (unsigned)nextRandom(state), (unsigned)nextRandom(state), paths[(random >> 16) % 5],
+                 (unsigned)((random >> 20) % 10000), ((random >> 36) % 20 == 0) ? 500u : 200u,
+                 (unsigned)((random >> 40) % 300));
+
+        position = appendString(buff, length, position, line);
+    }
+}
+
+static void generateOneByte(uint8_t* buff, size_t length, uint64_t* state) {
+    (void)state;
+    memset(buff, 'a', length);
+}
+
+/*
+Mostly zeros, with one random byte in about every 64.
+*/
+static void generateSparse(uint8_t* buff, size_t length, uint64_t* state) {
+    uint64_t random;
+
+    memset(buff, 0, length);
+
+    for (size_t i = 0; i < length; ++i) {
+        random = nextRandom(state);
+
+        if ((random & 63) == 0) {
+            buff[i] = (uint8_t)(random >> 8);
+        }
+    }
+}
+
+static double wallTime(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+/*
+This function turns the run times of <numberOfRuns> runs over <size> bytes
+into throughput statistics in MB/s.
+*/
+static void summarize(const double* seconds, uint32_t numberOfRuns, double size, benchStats* stats) {
+    double rate, sum = 0.0, squares = 0.0;
+
+    stats->min = INFINITY;
+    stats->max = 0.0;
+
+    for (uint32_t i = 0; i < numberOfRuns; ++i) {
+        rate = size / 1e6 / ((seconds[i] > 0.0) ? seconds[i] : 1e-9);
+        sum += rate;
+        squares += rate * rate;
+        stats->min = (rate < stats->min) ? rate : stats->min;
+        stats->max = (rate > stats->max) ? rate : stats->max;
+    }
+
+    stats->mean = sum / numberOfRuns;
+    stats->stddev = (numberOfRuns > 1) ? sqrt(fmax(0.0, (squares - sum * stats->mean) / (numberOfRuns - 1))) : 0.0;
+}
+
+static bool writeFile(const char* fileName, const uint8_t* buff, size_t length) {
+    FILE *file = fopen(fileName, "wb");
+    bool result = file && fwrite(buff, sizeof(uint8_t), length, file) == length;
+
+    return file && fclose(file) == 0 && result;
+}
+
+static bool readFile(const char* fileName, uint8_t* buff, size_t capacity, size_t* length) {
+    FILE *file = fopen(fileName, "rb");
+
+    if (file == NULL) {
+        return false;
+    }
+
+    *length = fread(buff, sizeof(uint8_t), capacity, file);
+    fclose(file);
+
+    return true;
+}
+
+/*
+One line of JSON per corpus and mode, so results can be collected and
+compared by scripts.
+*/
+static void report(FILE* output, const char* corpus, const char* mode, uint32_t threads, size_t size,
+                   size_t archiveSize, uint32_t numberOfRuns, const benchStats* encode, const benchStats* decode) {
+    fprintf(output, "{\"corpus\":\"%s\",\"mode\":\"%s\",\"threads\":%u,\"size\":%zu,\"archive_size\":%zu,"
+                    "\"ratio\":%.4f,\"runs\":%u,"
+                    "\"compress_mbps\":{\"mean\":%.2f,\"stddev\":%.2f,\"min\":%.2f,\"max\":%.2f},"
+                    "\"decompress_mbps\":{\"mean\":%.2f,\"stddev\":%.2f,\"min\":%.2f,\"max\":%.2f}}\n",
+            corpus, mode, threads, size, archiveSize, (size > 0) ? (double)archiveSize / (double)size : 0.0,
+            numberOfRuns, encode->mean, encode->stddev, encode->min, encode->max,
+            decode->mean, decode->stddev, decode->min, decode->max);
+
+    fprintf(stderr, "%-9s %-6s %2u  ratio %.4f  compress %8.1f MB/s (+-%5.1f)  decompress %8.1f MB/s (+-%5.1f)\n",
+            corpus, mode, threads, (size > 0) ? (double)archiveSize / (double)size : 0.0,
+            encode->mean, encode->stddev, decode->mean, decode->stddev);
+}
+
+/*
+The codec alone: compressBuffer() and decompressBuffer() between memory
+buffers, on the calling thread, with the output checked after every run.
+*/
+static bool benchBuffer(ARCH* arch, const benchCorpus* corpus, const uint8_t* data, size_t size,
+                        uint32_t numberOfRuns, FILE* output) {
+    size_t capacity = compressBound(size);
+    uint8_t *archive = (uint8_t*) malloc(capacity);
+    uint8_t *decoded = (uint8_t*) malloc(size + 1);
+    double *encodeTimes = (double*) calloc(numberOfRuns, sizeof(double));
+    double *decodeTimes = (double*) calloc(numberOfRuns, sizeof(double));
+    size_t archiveSize = 0, decodedSize = 0;
+    benchStats encode, decode;
+    double start;
+    bool result = false;
+
+    if (archive == NULL || decoded == NULL || encodeTimes == NULL || decodeTimes == NULL) {
+        goto finish;
+    }
+
+    /* the first runs only warm up caches and allocations and are not timed */
+    for (uint32_t i = 0; i < BENCH_WARMUP_RUNS + numberOfRuns; ++i) {
+        start = wallTime();
+
+        if (!compressBuffer(arch, archive, capacity, &archiveSize, data, size)) {
+            goto finish;
+        }
+
+        if (i >= BENCH_WARMUP_RUNS) {
+            encodeTimes[i - BENCH_WARMUP_RUNS] = wallTime() - start;
+        }
+
+        start = wallTime();
+
+        if (!decompressBuffer(arch, decoded, size, &decodedSize, archive, archiveSize)) {
+            goto finish;
+        }
+
+        if (i >= BENCH_WARMUP_RUNS) {
+            decodeTimes[i - BENCH_WARMUP_RUNS] = wallTime() - start;
+        }
+
+        if (decodedSize != size || memcmp(decoded, data, size) != 0) {
+            goto finish;
+        }
+    }
+
+    summarize(encodeTimes, numberOfRuns, (double)size, &encode);
+    summarize(decodeTimes, numberOfRuns, (double)size, &decode);
+    report(output, corpus->name, "buffer", 1, size, archiveSize, numberOfRuns, &encode, &decode);
+    result = true;
+
+finish:
+
+    free(archive);
+    free(decoded);
+    free(encodeTimes);
+    free(decodeTimes);
+
+    return result;
+}
+
+/*
+The whole tool path: compress() and decompress() between files on disk
+with the number of threads of <arch>, including the file I/O.
+*/
+static bool benchFile(ARCH* arch, const benchCorpus* corpus, const uint8_t* data, size_t size,
+                      uint32_t numberOfRuns, FILE* output) {
+    char sourceName[] = "/tmp/huff_bench_XXXXXX";
+    char archiveName[sizeof(sourceName) + 4];
+    char decodedName[sizeof(sourceName) + 4];
+    uint8_t *decoded = (uint8_t*) malloc(size + 1);
+    double *encodeTimes = (double*) calloc(numberOfRuns, sizeof(double));
+    double *decodeTimes = (double*) calloc(numberOfRuns, sizeof(double));
+    size_t archiveSize = 0, decodedSize = 0;
+    benchStats encode, decode;
+    FILE *archiveFile;
+    double start;
+    int fd = mkstemp(sourceName);
+    bool result = false;
+
+    snprintf(archiveName, sizeof(archiveName), "%s.huf", sourceName);
+    snprintf(decodedName, sizeof(decodedName), "%s.out", sourceName);
+
+    if (fd < 0 || close(fd) != 0 || decoded == NULL || encodeTimes == NULL || decodeTimes == NULL ||
+        !writeFile(sourceName, data, size)) {
+        goto finish;
+    }
+
+    /* the first runs only warm up caches and allocations and are not timed */
+    for (uint32_t i = 0; i < BENCH_WARMUP_RUNS + numberOfRuns; ++i) {
+        start = wallTime();
+
+        if (!compress(arch, archiveName, sourceName)) {
+            goto finish;
+        }
+
+        if (i >= BENCH_WARMUP_RUNS) {
+            encodeTimes[i - BENCH_WARMUP_RUNS] = wallTime() - start;
+        }
+
+        start = wallTime();
+
+        if (!decompress(arch, decodedName, archiveName)) {
+            goto finish;
+        }
+
+        if (i >= BENCH_WARMUP_RUNS) {
+            decodeTimes[i - BENCH_WARMUP_RUNS] = wallTime() - start;
+        }
+
+        if (!readFile(decodedName, decoded, size + 1, &decodedSize) ||
+            decodedSize != size || memcmp(decoded, data, size) != 0) {
+            goto finish;
+        }
+    }
+
+    if ((archiveFile = fopen(archiveName, "rb")) == NULL) {
+        goto finish;
+    }
+
+    fseek(archiveFile, 0, SEEK_END);
+    archiveSize = (size_t)ftell(archiveFile);
+    fclose(archiveFile);
+
+    summarize(encodeTimes, numberOfRuns, (double)size, &encode);
+    summarize(decodeTimes, numberOfRuns, (double)size, &decode);
+    report(output, corpus->name, "file", arch->numberOfThreads, size, archiveSize, numberOfRuns, &encode, &decode);
+    result = true;
+
+finish:
+
+    if (fd >= 0) {
+        remove(sourceName);
+        remove(archiveName);
+        remove(decodedName);
+    }
+
+    free(decoded);
+    free(encodeTimes);
+    free(decodeTimes);
+
+    return result;
+}
+
+/*
+Every corpus is compressed and decompressed <runs> times in memory and
+through files. Results go to the standard output as JSON lines and a
+readable summary goes to the standard error.
+*/
+int main(int argc, char **argv) {
+    extern char* optarg;
+    size_t size = BENCH_SIZE;
+    uint32_t numberOfRuns = BENCH_RUNS;
+    uint32_t numberOfThreads = 1;
+    uint64_t state;
+    uint8_t *data;
+    ARCH *arch;
+    int c;
+    bool result = true;
+
+    while ((c = getopt(argc, argv, "s:r:j:")) != -1) {
+        switch (c) {
+            case 's':
+                size = (size_t)strtoull(optarg, NULL, 10);
+                break;
+            case 'r':
+                numberOfRuns = (uint32_t)atoi(optarg);
+                break;
+            case 'j':
+                numberOfThreads = (uint32_t)atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-s size] [-r runs] [-j threads]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if (numberOfRuns < 1 || numberOfThreads < 1) {
+        fprintf(stderr, "usage: %s [-s size] [-r runs] [-j threads]\n", argv[0]);
+        return 1;
+    }
+
+    data = (uint8_t*) malloc(size + 1);
+    arch = initArch();
+
+    if (data == NULL || arch == NULL) {
+        return 1;
+    }
+
+    arch->numberOfThreads = numberOfThreads;
+
+    for (size_t i = 0; i < sizeof(corpora) / sizeof(corpora[0]); ++i) {
+        state = BENCH_SEED + i;
+        corpora[i].generate(data, size, &state);
+
+        if (!benchBuffer(arch, &(corpora[i]), data, size, numberOfRuns, stdout) ||
+            !benchFile(arch, &(corpora[i]), data, size, numberOfRuns, stdout)) {
+            fprintf(stderr, "%s: failed\n", corpora[i].name);
+            result = false;
+        }
+    }
+
+    freeArch(arch);
+    free(data);
+
+    return result ? 0 : 1;
+}
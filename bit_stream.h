@@ -0,0 +1,139 @@
+#ifndef BIT_STREAM_H
+#define BIT_STREAM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#define PACKED_LENGTH_BITS 4
+#define PACKED_LENGTH_MASK ((1u << PACKED_LENGTH_BITS) - 1)
+
+typedef struct bitWriter bitWriter;
+typedef struct bitReader bitReader;
+
+/*
+Codes are collected from the least significant bit of a 64-bit
+accumulator. A flush stores all 8 bytes of it and advances the output by
+the whole bytes it holds, so it needs no branch and up to 7 bytes of
+slack past the end of the output. After a flush at most 7 bits are left,
+which leaves room for BITS_PER_FLUSH more bits.
+*/
+struct bitWriter {
+    uint64_t bitBuffer;
+    uint32_t bitCount;
+    uint8_t *start;
+    uint8_t *ptr;
+};
+
+/*
+Coded bytes are read into the least significant bits of a 64-bit buffer
+with one unaligned 8-byte load per refill, which tops it up to at least
+BITS_PER_REFILL bits whatever it held, so a refill is good for several
+codes. The load only advances <next> by the whole bytes it added, and
+bits above <bitCount> are either the next bits or zero. Within the last
+8 bytes the reader goes a byte at a time, and past <end> it supplies
+zero bits, counted in <padBits>, so it never reads past its data.
+*/
+struct bitReader {
+    uint64_t bitBuffer;
+    uint32_t bitCount;
+    uint32_t padBits;
+    const uint8_t *next;
+    const uint8_t *end;
+};
+
+#define BITS_PER_FLUSH 56
+#define BITS_PER_REFILL 56
+
+/*
+A packed code table entry holds a code above its length, so one load
+gives both.
+*/
+static inline uint16_t packCode(uint32_t code, uint32_t length) {
+    return (uint16_t)((code << PACKED_LENGTH_BITS) | length);
+}
+
+static inline void initBitWriter(bitWriter* self, void* dst) {
+    self->bitBuffer = 0;
+    self->bitCount = 0;
+    self->start = (uint8_t*) dst;
+    self->ptr = (uint8_t*) dst;
+}
+
+static inline void addCode(bitWriter* self, uint16_t packedCode) {
+    self->bitBuffer |= (uint64_t)(packedCode >> PACKED_LENGTH_BITS) << self->bitCount;
+    self->bitCount += packedCode & PACKED_LENGTH_MASK;
+}
+
+static inline void flushBits(bitWriter* self) {
+    uint32_t bytes = self->bitCount >> 3;
+
+    memcpy(self->ptr, &(self->bitBuffer), sizeof(uint64_t));
+    self->ptr += bytes;
+    self->bitBuffer >>= bytes * 8;
+    self->bitCount &= 7;
+}
+
+/*
+This function writes out the last partial byte and returns the number of
+bytes produced. The bytes after it up to the 8-byte slack are zero.
+*/
+static inline size_t closeBitWriter(bitWriter* self) {
+    flushBits(self);
+
+    return (size_t)(self->ptr - self->start) + (self->bitCount > 0);
+}
+
+static inline void initBitReader(bitReader* self, const void* data, uint32_t dataWords) {
+    self->bitBuffer = 0;
+    self->bitCount = 0;
+    self->padBits = 0;
+    self->next = (const uint8_t*) data;
+    self->end = self->next + (size_t)dataWords * sizeof(uint32_t);
+}
+
+static inline void refillBitsTail(bitReader* self) {
+    while (self->bitCount <= BITS_PER_REFILL && self->next < self->end) {
+        self->bitBuffer |= (uint64_t)*(self->next) << self->bitCount;
+        self->next++;
+        self->bitCount += 8;
+    }
+
+    if (self->bitCount < BITS_PER_REFILL) {
+        self->padBits += BITS_PER_REFILL - self->bitCount;
+        self->bitCount = BITS_PER_REFILL;
+    }
+}
+
+static inline void refillBits(bitReader* self) {
+    uint64_t bits;
+
+    if (self->end - self->next >= (ptrdiff_t)sizeof(uint64_t)) {
+        memcpy(&bits, self->next, sizeof(uint64_t));
+        self->bitBuffer |= bits << self->bitCount;
+        self->next += (63 - self->bitCount) >> 3;
+        self->bitCount |= BITS_PER_REFILL;
+    } else {
+        refillBitsTail(self);
+    }
+}
+
+static inline uint32_t peekBits(const bitReader* self, uint32_t mask) {
+    return (uint32_t)(self->bitBuffer & mask);
+}
+
+static inline void skipBits(bitReader* self, uint32_t bits) {
+    self->bitBuffer >>= bits;
+    self->bitCount -= bits;
+}
+
+/*
+A stream is padded with zeros to whole words, so one that has used any
+of the zero bits past its end is corrupt.
+*/
+static inline bool hasReaderOverrun(const bitReader* self) {
+    return self->padBits > self->bitCount;
+}
+
+#endif
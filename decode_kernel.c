@@ -0,0 +1,192 @@
+#include "huffman.h"
+#include "bit_stream.h"
+#include "decode_kernel.h"
+
+#define LOOKUPS_PER_REFILL (BITS_PER_REFILL / LOOKUP_BITS)
+
+#if LOOKUPS_PER_REFILL < 1
+#error "a refill of the bit reader must hold at least one lookup"
+#endif
+
+/*
+This function decodes <length> symbols of one stream into <writeBuff>.
+It resolves one symbol per lookup in the decode table, or up to
+MULTI_SYMBOLS with the multi-symbol table when the table of the block
+chose it. No lookup takes more than LOOKUP_BITS bits, so one refill is
+good for LOOKUPS_PER_REFILL of them; the last few symbols go one at a
+time, so no lookup can write past <length>. It reads from a copy of
+<stream>: the output goes through a byte pointer, which may alias
+anything, so the reader would otherwise be reloaded after every store.
+*/
+static inline __attribute__((always_inline)) bool decodeStream(const ARCH* self, const bitReader* stream,
+                                                               uint8_t* writeBuff, uint32_t length) {
+    bitReader localReader = *stream;
+    bitReader *reader = &localReader;
+    const decodeEntry *decodeTable = self->decodeTable;
+    const multiDecodeEntry *multiDecodeTable = self->multiDecodeTable;
+    decodeEntry entry;
+    multiDecodeEntry multiEntry;
+    uint32_t currentWriteBuffByte = 0;
+    uint32_t i;
+
+    while (self->useMultiDecode && length - currentWriteBuffByte >= LOOKUPS_PER_REFILL * MULTI_SYMBOLS) {
+        refillBits(reader);
+
+        for (i = 0; i < LOOKUPS_PER_REFILL; ++i) {
+            multiEntry = multiDecodeTable[peekBits(reader, LOOKUP_MASK)];
+
+            if (multiEntry.length > LOOKUP_BITS) {
+                return false;
+            }
+
+            memcpy(writeBuff + currentWriteBuffByte, multiEntry.symbols, MULTI_SYMBOLS);
+            currentWriteBuffByte += multiEntry.count;
+            skipBits(reader, multiEntry.length);
+        }
+    }
+
+    while (length - currentWriteBuffByte >= LOOKUPS_PER_REFILL) {
+        refillBits(reader);
+
+        for (i = 0; i < LOOKUPS_PER_REFILL; ++i) {
+            entry = decodeTable[peekBits(reader, LOOKUP_MASK)];
+
+            if (entry.length > MAX_CODE_LENGTH) {
+                return false;
+            }
+
+            writeBuff[currentWriteBuffByte++] = entry.symb;
+            skipBits(reader, entry.length);
+        }
+    }
+
+    for (; currentWriteBuffByte < length; ++currentWriteBuffByte) {
+        refillBits(reader);
+        entry = decodeTable[peekBits(reader, LOOKUP_MASK)];
+
+        if (entry.length > MAX_CODE_LENGTH) {
+            return false;
+        }
+
+        writeBuff[currentWriteBuffByte] = entry.symb;
+        skipBits(reader, entry.length);
+    }
+
+    return !hasReaderOverrun(reader);
+}
+
+/*
+This function decodes NUMBER_OF_STREAMS streams in one loop that takes a
+step in each of them per lookup. The streams do not depend on each other,
+so their lookups overlap in the processor instead of waiting on one
+another. Once the shortest stream gets near its end, each one finishes
+on its own. Like decodeStream(), it reads from copies of <streams>.
+*/
+static inline __attribute__((always_inline)) bool decodeStreams(const ARCH* self, const bitReader streams[],
+                                                                uint8_t* writeBuffs[], const uint32_t lengths[]) {
+    const decodeEntry *decodeTable = self->decodeTable;
+    const multiDecodeEntry *multiDecodeTable = self->multiDecodeTable;
+    multiDecodeEntry multiEntry;
+    decodeEntry entry;
+    bitReader readers[NUMBER_OF_STREAMS];
+    uint32_t positions[NUMBER_OF_STREAMS] = {0};
+    uint32_t rounds = lengths[NUMBER_OF_STREAMS - 1];
+    uint32_t furthest = 0;
+    uint32_t i, j, k;
+    bool isValid = true;
+
+    for (i = 0; i < NUMBER_OF_STREAMS; ++i) {
+        readers[i] = streams[i];
+        rounds = (lengths[i] < rounds) ? lengths[i] : rounds;
+    }
+
+    if (self->useMultiDecode) {
+        /* every round writes at most MULTI_SYMBOLS per stream and lookup */
+        while (isValid && rounds - furthest >= LOOKUPS_PER_REFILL * MULTI_SYMBOLS) {
+            for (i = 0; i < NUMBER_OF_STREAMS; ++i) {
+                refillBits(&(readers[i]));
+            }
+
+            for (k = 0; k < LOOKUPS_PER_REFILL; ++k) {
+                for (i = 0; i < NUMBER_OF_STREAMS; ++i) {
+                    multiEntry = multiDecodeTable[peekBits(&(readers[i]), LOOKUP_MASK)];
+                    isValid = isValid && multiEntry.length <= LOOKUP_BITS;
+                    memcpy(writeBuffs[i] + positions[i], multiEntry.symbols, MULTI_SYMBOLS);
+                    positions[i] += multiEntry.count;
+                    furthest = (positions[i] > furthest) ? positions[i] : furthest;
+                    skipBits(&(readers[i]), isValid ? multiEntry.length : 0);
+                }
+            }
+        }
+    } else {
+        for (j = 0; isValid && rounds - j >= LOOKUPS_PER_REFILL; j += LOOKUPS_PER_REFILL) {
+            for (i = 0; i < NUMBER_OF_STREAMS; ++i) {
+                refillBits(&(readers[i]));
+            }
+
+            for (k = 0; k < LOOKUPS_PER_REFILL; ++k) {
+                for (i = 0; i < NUMBER_OF_STREAMS; ++i) {
+                    entry = decodeTable[peekBits(&(readers[i]), LOOKUP_MASK)];
+                    isValid = isValid && entry.length <= MAX_CODE_LENGTH;
+                    writeBuffs[i][j + k] = entry.symb;
+                    skipBits(&(readers[i]), isValid ? entry.length : 0);
+                }
+            }
+        }
+
+        for (i = 0; i < NUMBER_OF_STREAMS; ++i) {
+            positions[i] = j;
+        }
+    }
+
+    for (i = 0; isValid && i < NUMBER_OF_STREAMS; ++i) {
+        isValid = decodeStream(self, &(readers[i]), writeBuffs[i] + positions[i], lengths[i] - positions[i]);
+    }
+
+    return isValid;
+}
+
+static inline __attribute__((always_inline)) bool decodeBlockStreams(const ARCH* self, const bitReader readers[],
+                                                                     uint8_t* writeBuffs[],
+                                                                     const uint32_t lengths[],
+                                                                     uint32_t streams) {
+    if (streams == NUMBER_OF_STREAMS) {
+        return decodeStreams(self, readers, writeBuffs, lengths);
+    }
+
+    return decodeStream(self, &(readers[0]), writeBuffs[0], lengths[0]);
+}
+
+bool decodeScalar(const ARCH* self, const bitReader readers[], uint8_t* writeBuffs[], const uint32_t lengths[],
+                  uint32_t streams) {
+    return decodeBlockStreams(self, readers, writeBuffs, lengths, streams);
+}
+
+#if defined(__x86_64__)
+
+/*
+The same loops with BMI2: the reader shifts by the code lengths with
+shrx and shlx, which take the count in any register and leave the flags
+alone, so the chain from one lookup to the next is shorter. The fields
+read are contiguous and under a constant mask, so bzhi and pext have
+nothing to add over a plain and.
+*/
+__attribute__((target("bmi2")))
+bool decodeBMI2(const ARCH* self, const bitReader readers[], uint8_t* writeBuffs[], const uint32_t lengths[],
+                uint32_t streams) {
+    return decodeBlockStreams(self, readers, writeBuffs, lengths, streams);
+}
+
+#endif
+
+decodeKernel selectDecodeKernel(void) {
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("bmi2")) {
+        return decodeBMI2;
+    }
+#endif
+
+    return decodeScalar;
+}
@@ -0,0 +1,15 @@
+#ifndef DECODE_KERNEL_H
+#define DECODE_KERNEL_H
+
+#include "huffman.h"
+#include "bit_stream.h"
+
+bool decodeScalar(const ARCH* self, const bitReader readers[], uint8_t* writeBuffs[], const uint32_t lengths[],
+                  uint32_t streams);
+#if defined(__x86_64__)
+bool decodeBMI2(const ARCH* self, const bitReader readers[], uint8_t* writeBuffs[], const uint32_t lengths[],
+                uint32_t streams);
+#endif
+decodeKernel selectDecodeKernel(void);
+
+#endif
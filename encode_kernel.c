@@ -0,0 +1,154 @@
+#include "huffman.h"
+#include "bit_stream.h"
+#include "encode_kernel.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#if CODES_PER_FLUSH * MAX_CODE_LENGTH > BITS_PER_FLUSH
+#error "CODES_PER_FLUSH codes must fit between two flushes of the bit writer"
+#endif
+
+#if 4 * MAX_CODE_LENGTH > BITS_PER_FLUSH
+#error "a group of four codes must fit between two flushes of the bit writer"
+#endif
+
+/*
+No code is longer than MAX_CODE_LENGTH bits, so a group of
+CODES_PER_FLUSH codes always fits the bit writer between two flushes.
+The loop is shared by the kernels that only differ in the instructions
+the compiler may use for it, which is why it is always inlined.
+*/
+static inline __attribute__((always_inline)) uint32_t encodeCodes(const uint16_t encodeTable[],
+                                                                  const uint8_t* srcBuff, uint32_t length,
+                                                                  bitWriter* writer, uint32_t i) {
+    for (; i + CODES_PER_FLUSH <= length; i += CODES_PER_FLUSH) {
+        addCode(writer, encodeTable[srcBuff[i]]);
+        addCode(writer, encodeTable[srcBuff[i + 1]]);
+        addCode(writer, encodeTable[srcBuff[i + 2]]);
+        addCode(writer, encodeTable[srcBuff[i + 3]]);
+        flushBits(writer);
+    }
+
+    for (; i < length; ++i) {
+        addCode(writer, encodeTable[srcBuff[i]]);
+    }
+
+    return (uint32_t)((closeBitWriter(writer) + sizeof(uint32_t) - 1) / sizeof(uint32_t));
+}
+
+uint32_t encodeScalar(const uint16_t encodeTable[], const uint8_t* srcBuff, uint32_t length, void* dstBuff) {
+    bitWriter writer;
+
+    initBitWriter(&writer, dstBuff);
+
+    return encodeCodes(encodeTable, srcBuff, length, &writer, 0);
+}
+
+#if defined(__x86_64__)
+
+/*
+The scalar loop with BMI2, whose shifts by a register neither need the
+count in CL nor touch the flags, which shortens the chain through the
+bit count.
+*/
+__attribute__((target("bmi2")))
+uint32_t encodeBMI2(const uint16_t encodeTable[], const uint8_t* srcBuff, uint32_t length, void* dstBuff) {
+    bitWriter writer;
+
+    initBitWriter(&writer, dstBuff);
+
+    return encodeCodes(encodeTable, srcBuff, length, &writer, 0);
+}
+
+/*
+This function adds <chunk> of <bits> bits, the codes of several bytes
+already joined, to the writer and flushes it.
+*/
+__attribute__((target("avx2,bmi2")))
+static inline void addChunk(bitWriter* writer, uint64_t chunk, uint64_t bits) {
+    writer->bitBuffer |= chunk << writer->bitCount;
+    writer->bitCount += (uint32_t)bits;
+    flushBits(writer);
+}
+
+/*
+The AVX2 kernel takes 16 bytes at a time. Their codes are gathered from
+a copy of the table widened to 32 bits, and neighbours are joined in
+registers: each odd code is shifted past the length of the even one
+before it and added to it, first in 32-bit lanes, giving pairs of at
+most 2 * MAX_CODE_LENGTH bits, then in 64-bit lanes, giving runs of four
+codes. Only the four runs go through the bit writer, so the serial chain
+through its bit count is four steps long instead of sixteen. The rest of
+the input is coded by the scalar loop on the same writer.
+*/
+__attribute__((target("avx2,bmi2")))
+uint32_t encodeAVX2(const uint16_t encodeTable[], const uint8_t* srcBuff, uint32_t length, void* dstBuff) {
+    uint32_t table[256];
+    bitWriter writer;
+    uint32_t i = 0;
+    __m256i lengthMask = _mm256_set1_epi32(PACKED_LENGTH_MASK);
+    __m256i lowHalves = _mm256_set1_epi64x(0xFFFFFFFF);
+    __m256i packed, codes, lengths, pairCodes, pairLengths, runCodes, runLengths;
+    __m128i bytes;
+
+    initBitWriter(&writer, dstBuff);
+
+    if (length < VECTOR_ENCODE_MIN_LENGTH) {
+        return encodeCodes(encodeTable, srcBuff, length, &writer, 0);
+    }
+
+    for (uint32_t j = 0; j < 256; ++j) {
+        table[j] = encodeTable[j];
+    }
+
+    for (; i + 16 <= length; i += 16) {
+        bytes = _mm_loadu_si128((const __m128i*)(srcBuff + i));
+
+        for (uint32_t half = 0; half < 2; ++half) {
+            packed = _mm256_i32gather_epi32((const int*)table, _mm256_cvtepu8_epi32(bytes), 4);
+            bytes = _mm_srli_si128(bytes, 8);
+
+            codes = _mm256_srli_epi32(packed, PACKED_LENGTH_BITS);
+            lengths = _mm256_and_si256(packed, lengthMask);
+
+            /* odd 32-bit lanes shifted by the length of the even lane below */
+            pairCodes = _mm256_sllv_epi32(codes, _mm256_slli_epi64(lengths, 32));
+            pairCodes = _mm256_and_si256(_mm256_or_si256(codes, _mm256_srli_epi64(pairCodes, 32)), lowHalves);
+            pairLengths = _mm256_and_si256(_mm256_add_epi32(lengths, _mm256_srli_epi64(lengths, 32)), lowHalves);
+
+            /* odd 64-bit lanes shifted by the length of the even lane below */
+            runCodes = _mm256_sllv_epi64(pairCodes, _mm256_slli_si256(pairLengths, 8));
+            runCodes = _mm256_or_si256(pairCodes, _mm256_srli_si256(runCodes, 8));
+            runLengths = _mm256_add_epi64(pairLengths, _mm256_srli_si256(pairLengths, 8));
+
+            addChunk(&writer, (uint64_t)_mm256_extract_epi64(runCodes, 0), (uint64_t)_mm256_extract_epi64(runLengths, 0));
+            addChunk(&writer, (uint64_t)_mm256_extract_epi64(runCodes, 2), (uint64_t)_mm256_extract_epi64(runLengths, 2));
+        }
+    }
+
+    return encodeCodes(encodeTable, srcBuff, length, &writer, i);
+}
+
+#endif
+
+/*
+This function picks the fastest kernel the processor it runs on
+supports, as cpuid reports it, so one binary runs everywhere.
+*/
+encodeKernel selectEncodeKernel(void) {
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi2")) {
+        return encodeAVX2;
+    }
+
+    if (__builtin_cpu_supports("bmi2")) {
+        return encodeBMI2;
+    }
+#endif
+
+    return encodeScalar;
+}
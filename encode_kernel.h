@@ -0,0 +1,26 @@
+#ifndef ENCODE_KERNEL_H
+#define ENCODE_KERNEL_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#define VECTOR_ENCODE_MIN_LENGTH 256
+
+/*
+An encode kernel codes <length> bytes of <srcBuff> with a packed code
+table into <dstBuff> and returns the number of 32-bit words written. All
+kernels produce the same stream, zero-padded to a whole word, and need 8
+bytes of slack past it.
+*/
+typedef uint32_t (*encodeKernel)(const uint16_t encodeTable[], const uint8_t* srcBuff, uint32_t length,
+                                 void* dstBuff);
+
+uint32_t encodeScalar(const uint16_t encodeTable[], const uint8_t* srcBuff, uint32_t length, void* dstBuff);
+#if defined(__x86_64__)
+uint32_t encodeBMI2(const uint16_t encodeTable[], const uint8_t* srcBuff, uint32_t length, void* dstBuff);
+uint32_t encodeAVX2(const uint16_t encodeTable[], const uint8_t* srcBuff, uint32_t length, void* dstBuff);
+#endif
+encodeKernel selectEncodeKernel(void);
+
+#endif
@@ -0,0 +1,88 @@
+#include "histogram.h"
+
+static void countChunk(uint32_t tables[HISTOGRAM_TABLES][256], const uint8_t*, size_t);
+
+/*
+Runs of one byte make a single counter the target of back-to-back
+increments, and each of them waits for the previous store. Consecutive
+bytes are therefore spread over HISTOGRAM_TABLES separate tables that are
+summed at the end, and the input is loaded 8 bytes at a time. The 32-bit
+tables are merged into the 64-bit <counts> every HISTOGRAM_CHUNK_SIZE
+bytes, before they could overflow.
+*/
+static void countChunk(uint32_t tables[HISTOGRAM_TABLES][256], const uint8_t* buff, size_t length) {
+    const uint8_t *end = buff + length;
+    uint64_t first, second;
+
+    while (end - buff >= 16) {
+        memcpy(&first, buff, sizeof(uint64_t));
+        memcpy(&second, buff + 8, sizeof(uint64_t));
+        buff += 16;
+
+        tables[0][(uint8_t)first]++;
+        tables[1][(uint8_t)(first >> 8)]++;
+        tables[2][(uint8_t)(first >> 16)]++;
+        tables[3][(uint8_t)(first >> 24)]++;
+        tables[0][(uint8_t)(first >> 32)]++;
+        tables[1][(uint8_t)(first >> 40)]++;
+        tables[2][(uint8_t)(first >> 48)]++;
+        tables[3][(uint8_t)(first >> 56)]++;
+
+        tables[0][(uint8_t)second]++;
+        tables[1][(uint8_t)(second >> 8)]++;
+        tables[2][(uint8_t)(second >> 16)]++;
+        tables[3][(uint8_t)(second >> 24)]++;
+        tables[0][(uint8_t)(second >> 32)]++;
+        tables[1][(uint8_t)(second >> 40)]++;
+        tables[2][(uint8_t)(second >> 48)]++;
+        tables[3][(uint8_t)(second >> 56)]++;
+    }
+
+    while (buff < end) {
+        tables[0][*buff++]++;
+    }
+}
+
+/*
+This function adds the number of occurrences of every byte value in
+<buff> to <counts>, so several buffers can be counted into one histogram.
+*/
+void countSymbols(uint64_t counts[256], const uint8_t* buff, size_t length) {
+    uint32_t tables[HISTOGRAM_TABLES][256];
+    size_t chunk;
+
+    while (length > 0) {
+        chunk = (length < HISTOGRAM_CHUNK_SIZE) ? length : HISTOGRAM_CHUNK_SIZE;
+
+        memset(tables, 0, sizeof(tables));
+        countChunk(tables, buff, chunk);
+
+        for (uint32_t i = 0; i < 256; ++i) {
+            counts[i] += (uint64_t)tables[0][i] + tables[1][i] + tables[2][i] + tables[3][i];
+        }
+
+        buff += chunk;
+        length -= chunk;
+    }
+}
+
+/*
+This function adds the counts of <chunks> chunks of SAMPLE_CHUNK_SIZE
+bytes spread evenly over <buff>, the first at its start and the last at
+its end, to <counts>. A buffer no larger than the chunks is counted
+whole.
+*/
+void sampleSymbols(uint64_t counts[256], const uint8_t* buff, uint64_t length, uint32_t chunks) {
+    uint64_t stride;
+
+    if (length <= (uint64_t)chunks * SAMPLE_CHUNK_SIZE) {
+        countSymbols(counts, buff, (size_t)length);
+        return;
+    }
+
+    stride = (chunks > 1) ? (length - SAMPLE_CHUNK_SIZE) / (chunks - 1) : 0;
+
+    for (uint32_t i = 0; i < chunks; ++i) {
+        countSymbols(counts, buff + i * stride, SAMPLE_CHUNK_SIZE);
+    }
+}
@@ -0,0 +1,16 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#define HISTOGRAM_TABLES 4
+#define HISTOGRAM_CHUNK_SIZE (1u << 30)
+#define SAMPLE_CHUNKS 64
+#define SAMPLE_CHUNK_SIZE (1u << 16)
+
+void countSymbols(uint64_t counts[256], const uint8_t* buff, size_t length);
+void sampleSymbols(uint64_t counts[256], const uint8_t* buff, uint64_t length, uint32_t chunks);
+
+#endif
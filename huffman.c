@@ -1,168 +1,242 @@
-#include "huffman.h"
+#define _POSIX_C_SOURCE 200809L
 
-static qtreeNode* initQTreeNode(void);
-static bool insertToQueue(ARCH*, qtreeNode*, qtreeNode*, bool);
-static void traverseTree(qtreeNode*, void (*)(qtreeNode*, uint8_t, uint32_t, codeInfo[]), 
-                            uint8_t, uint32_t, codeInfo[]);
-static inline void visitNode(qtreeNode*, uint8_t, uint32_t, codeInfo[]);
-static inline bool addElementToQueue(ARCH*, uint8_t, uint32_t);
-static bool rebuildTree(ARCH*, FILE*);
-static bool buildTree(ARCH*);
-static bool buildQueue(ARCH*, const char*);
-static bool generateCodeTable(ARCH*);
-static bool decodeFile(ARCH*, FILE*, FILE*);
-static uint32_t reverse_bits(uint32_t, uint32_t);
-static bool writeDataToFile(ARCH*, const char*, const char*);
-static bool writeCodesToFile(ARCH*, const char*);
-static bool writeArchiveInfo(ARCH*, const char*);
-static bool readArchiveInfo(ARCH*, FILE*);
-
-/*
-This function inserts an <src> node at the position
-of the <dst> node. <rightInsert> flag used for the cases
-when the <dst> node is the the head of the queue and we need
-to determine should the <src> node be appended or prepended. 
-*/
-static bool insertToQueue(ARCH* self, qtreeNode* dst, qtreeNode* src,  bool leftInsert) {
-/*    qtreeNode *head = self->head;
-    qtreeNode *tail = self->tail;*/
-
-    if (self->head == NULL) {
-        self->head = self->tail = src;
-    } else if (dst == self->head) {
-        if (!leftInsert) {
-            if (self->head == self->tail) {
-                self->tail = src;
-                self->head->nextNode = self->tail;
-            } else {
-                src->nextNode = self->head->nextNode;
-                self->head->nextNode = src;
-            }
-        } else {
-            src->nextNode = self->head;
-            self->head = src;
-        }
-    } else if (dst == self->tail) {
-        self->tail->nextNode = src;
-        src->nextNode = NULL;
-        self->tail = src;
-    } else {
-        src->nextNode = dst->nextNode;
-        dst->nextNode = src;
-    }
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 
-    return true;
-}
+#include "huffman.h"
+#include "thread_pool.h"
+#include "ring_buffer.h"
+#include "histogram.h"
+#include "bit_stream.h"
+#include "decode_kernel.h"
+#include "prog_bar.h"
+
+typedef struct encodeTask encodeTask;
+typedef struct decodeTask decodeTask;
+typedef struct blockBatch blockBatch;
+typedef struct blockPipeline blockPipeline;
+
+struct encodeTask {
+    ARCH **contexts;
+    blockJob *jobs;
+};
 
 /*
-This function adds a node to the queue. Because we should always
-keep the queue sorted in the order of rising node`s weight, the
-position of the new node determines by it`s weight.
+Shared state of an indexed decompression: every worker decodes whole
+blocks found through the index with its own context and buffers and
+writes them straight to their place in the output. When the files are
+mapped, blocks are decoded from <srcMap> into <dstMap> and the buffers
+are not used.
 */
-static inline bool addElementToQueue(ARCH* self, uint8_t symb, uint32_t value) {
-    qtreeNode *cPtr = self->head;
-    qtreeNode *newNode = initQTreeNode();
-
-    newNode->symb = symb;
-    newNode->weight = value;
+struct decodeTask {
+    ARCH **contexts;
+    blockJob *buffers;
+    bool *results;
+    uint64_t endOffset;
+    uint64_t rawSize;
+    uint64_t *progress;
+    mappedFile srcMap;
+    mappedFile dstMap;
+    int srcFd;
+    int dstFd;
+};
 
-    if (cPtr != NULL)  {
-        while (cPtr->nextNode != NULL) {
-            if (cPtr->nextNode->weight > value) {
-                break;
-            }
+/*
+A run of consecutive blocks that moves through a pipeline as a unit.
+*/
+struct blockBatch {
+    blockJob *jobs;
+    uint32_t numberOfJobs;
+};
 
-            cPtr = cPtr->nextNode;
-        }
+/*
+A pipeline overlaps the I/O of an operation with its coding. A reader
+thread fills batches from <srcFile>, the calling thread codes them in
+order and a writer thread writes them to <dstFile> and hands them back
+to the reader. The rings hold the PIPELINE_DEPTH batches, which bounds
+the memory, and <reader> and <writer> collect the statistics of their
+threads. The reader stops after <rawSize> raw bytes; <position> counts
+them and <srcMap> is the source when it is mapped.
+*/
+struct blockPipeline {
+    ARCH *self;
+    ARCH *reader;
+    ARCH *writer;
+    FILE *srcFile;
+    FILE *dstFile;
+    ringBuffer *empty;
+    ringBuffer *filled;
+    ringBuffer *coded;
+    blockBatch batches[PIPELINE_DEPTH];
+    uint32_t batchSize;
+    mappedFile srcMap;
+    uint64_t position;
+    uint64_t rawSize;
+    bool reachedEnd;
+    bool failed;
+    pthread_t readerThread;
+    pthread_t writerThread;
+};
+
+static uint16_t initQTreeNode(ARCH*);
+static void traverseTree(ARCH*, uint16_t, void (*)(qtreeNode*, uint8_t, codeInfo[]),
+                            uint8_t, codeInfo[]);
+static inline void visitNode(qtreeNode*, uint8_t, codeInfo[]);
+static bool rebuildTree(ARCH*, blockInfo*, const uint8_t[]);
+static bool buildTree(ARCH*);
+static bool buildQueue(ARCH*, const uint8_t*, uint32_t);
+static bool queueSymbols(ARCH*);
+static bool generateCodeTable(ARCH*);
+static void limitCodeLengths(ARCH*, codeInfo[]);
+static bool assignCanonicalCodes(codeInfo[]);
+static int compareWeights(const void*, const void*);
+static bool decodeFile(ARCH*, const blockInfo*, const uint8_t*, uint8_t*);
+static bool hasValidDataSize(const blockInfo*);
+static bool buildDecodeTable(ARCH*, codeInfo[]);
+static bool buildMultiDecodeTable(ARCH*);
+static uint32_t reverse_bits(uint32_t, uint32_t);
+static void encodeBlockData(ARCH*, blockInfo*, const uint16_t[], const uint8_t*, void*);
+static void storeBlockData(blockInfo*, const uint8_t*, uint8_t*);
+static uint32_t packCodeLengths(ARCH*, blockInfo*, uint8_t[]);
+static void analyzeBlock(ARCH*, blockJob*);
+static void analyzeBlockTask(void*, uint32_t, uint32_t);
+static void chooseBlockTable(ARCH*, blockJob*);
+static void storeBlock(blockJob*);
+static void buildSampledTable(ARCH*, const uint64_t[], blockJob*);
+static void useSampledTable(ARCH*, const blockJob*, blockJob*);
+static void recordBlockStats(ARCH*, const blockJob*, uint64_t);
+static void encodeBlock(ARCH*, blockJob*);
+static void encodeBlockTask(void*, uint32_t, uint32_t);
+static bool writeBlockToFile(ARCH*, const blockJob*, FILE*);
+static bool writeArchiveInfo(ARCH*, uint32_t, FILE*);
+static bool readArchiveInfo(ARCH*, uint32_t, FILE*);
+static bool startPipeline(blockPipeline*, ARCH*, FILE*, FILE*, uint32_t, void* (*)(void*), void* (*)(void*));
+static bool stopPipeline(blockPipeline*);
+static void failPipeline(blockPipeline*);
+static bool hasPipelineFailed(blockPipeline*);
+static void releasePipeline(blockPipeline*);
+static void* encodeReadLoop(void*);
+static void* encodeWriteLoop(void*);
+static void* decodeReadLoop(void*);
+static void* decodeWriteLoop(void*);
+static bool writeBlocks(ARCH*, FILE*, FILE*, uint64_t*, uint64_t*);
+static bool readBlocks(ARCH*, FILE*, FILE*, bool, uint64_t);
+static bool addIndexEntry(ARCH*, uint64_t, uint64_t, uint64_t);
+static bool writeArchiveIndex(ARCH*, uint64_t, uint64_t, FILE*);
+static bool readArchiveIndex(ARCH*, archiveTrailer*, FILE*);
+static size_t readData(ARCH*, void*, size_t, FILE*);
+static bool writeData(ARCH*, const void*, size_t, FILE*);
+static bool preadAll(ARCH*, int, void*, size_t, uint64_t);
+static bool pwriteAll(ARCH*, int, const void*, size_t, uint64_t);
+static bool readArchiveAt(ARCH*, const mappedFile*, int, void*, size_t, uint64_t);
+static bool mapInput(ARCH*, FILE*, mappedFile*);
+static bool mapOutput(ARCH*, FILE*, uint64_t, mappedFile*);
+static void unmapFile(mappedFile*);
+static bool loadBlockTable(ARCH*, const mappedFile*, int, uint64_t);
+static void decodeBlockTask(void*, uint32_t, uint32_t);
+static bool decompressIndexed(ARCH*, archiveTrailer*, FILE*, FILE*);
+static bool isOutputAtStart(FILE*);
+static void resetTree(ARCH*);
+static bool reserveWorkers(ARCH*);
+static void releaseWorkers(ARCH*);
+static void startWorkerStats(ARCH*);
+static void mergeWorkerStats(ARCH*);
+static bool reserveJobs(ARCH*, uint32_t, uint32_t);
+static void releaseJobs(ARCH*);
+static FILE* openFile(const char*, const char*);
+static bool closeFile(FILE*);
+static uint8_t* readContainerDirectory(ARCH*, containerTrailer*, FILE*);
+static bool nextMember(const uint8_t*, const containerTrailer*, uint64_t*, memberEntry*, const char**);
 
-        insertToQueue(self, cPtr, newNode, (bool)(cPtr->weight < value));
-    } else {
-        insertToQueue(self, cPtr, newNode, true);
-    }    
+/*
+This function counts the block and queues its symbols. A block is never
+larger than ARCHIVE_MAX_BLOCK_SIZE, so its counts fit the 32-bit node
+weights.
+*/
+static bool buildQueue(ARCH* self, const uint8_t* buff, uint32_t length) {
+    memset(self->frequencies, 0, sizeof(self->frequencies));
+    countSymbols(self->frequencies, buff, length);
 
-    return true;
+    return queueSymbols(self);
 }
 
-static bool buildQueue(ARCH* self, const char* srcFileName) {
-    uint32_t symbols[256] = {0};
-    uint8_t buff[BUFFER_SIZE] = {0};
-    uint32_t readedChars;
+/*
+This function creates a leaf for every byte value with a count in
+<frequencies> and sorts the leaves by rising weight, once.
+*/
+static bool queueSymbols(ARCH* self) {
+    uint64_t *symbols = self->frequencies;
+    symbolWeight order[256];
+    uint32_t numberOfSymbols = 0;
+    uint16_t leaf;
     uint32_t i;
 
-    FILE *text = fopen(srcFileName, "r");
-    
-    while ((bool)(readedChars = fread(buff, sizeof(uint8_t), BUFFER_SIZE, text))) {
-        for (i = 0; i < readedChars; ++i) {
-            symbols[buff[i]]++;    
-        }
-    }
-
     for (i = 0; i < 256; i++) {
         if (symbols[i] > 0) {
-            addElementToQueue(self, i, symbols[i]);
+            order[numberOfSymbols++] = (symbolWeight){(uint32_t)symbols[i], (uint8_t)i};
         }
     }
 
-    fclose(text);
+    /* heaviest first, so the leaves are taken from the back */
+    qsort(order, numberOfSymbols, sizeof(symbolWeight), compareWeights);
+
+    for (i = numberOfSymbols; i-- > 0;) {
+        leaf = initQTreeNode(self);
+        self->nodes[leaf].symb = order[i].symb;
+        self->nodes[leaf].weight = order[i].weight;
+        self->nodes[leaf].isLeaf = true;
+
+        self->leaves[self->numberOfLeaves++] = leaf;
+    }
+
     return true;
 }
 
+/*
+Classic two-queue construction: the sorted leaves form one queue and the
+merged nodes, which are created with non-decreasing weights, form the
+other, so the two lightest nodes are always found at the two fronts and
+the tree is built in linear time. On equal weights leaves go first.
+*/
 static bool buildTree(ARCH* self) {
-    qtreeNode *firstNode, *secondNode, *newNode, *cPtr;
+    qtreeNode *nodes = self->nodes;
+    uint16_t merged[256];
+    uint16_t children[2];
+    uint16_t newNode;
+    uint32_t numberOfLeaves = self->numberOfLeaves;
+    uint32_t nextLeaf = 0, nextMerged = 0, numberOfMerged = 0;
 
-    if (self->head == self->tail) {
-        self->root = initQTreeNode();
-        self->root->lchild = self->head;
+    if (numberOfLeaves < 2) {
+        self->root = initQTreeNode(self);
+        nodes[self->root].lchild = (numberOfLeaves > 0) ? self->leaves[0] : NO_NODE;
 
         return true;
     }
 
-    while (self->head != self->tail) {     
-        firstNode = self->head;
-        secondNode = firstNode->nextNode;
-        newNode = initQTreeNode();
-
-        newNode->weight = firstNode->weight + secondNode->weight;
-        newNode->lchild = firstNode;
-        newNode->rchild = secondNode;
-        newNode->nextNode = secondNode->nextNode;
-
-        if (self->head->nextNode != self->tail) {
-            if (newNode->nextNode->weight < newNode->weight) {
-                self->head = newNode->nextNode;
-                cPtr = self->head;
-
-                while (cPtr->nextNode && (cPtr->nextNode->weight < newNode->weight)) {
-                    cPtr = cPtr->nextNode;
-                }
-
-                insertToQueue(self, cPtr, newNode, (bool)(cPtr->weight < newNode->weight));
+    while (numberOfMerged < numberOfLeaves - 1) {
+        for (int i = 0; i < 2; ++i) {
+            if (nextLeaf < numberOfLeaves && (nextMerged == numberOfMerged ||
+                nodes[self->leaves[nextLeaf]].weight <= nodes[merged[nextMerged]].weight)) {
+                children[i] = self->leaves[nextLeaf++];
             } else {
-                self->head = newNode;
+                children[i] = merged[nextMerged++];
             }
-        } else {
-            newNode->nextNode = NULL;
-            self->head = self->tail = newNode;
-            self->root = newNode;
         }
-    }
-
-    return true;
-}
 
-//assumes little endian
-void printBits(uint32_t const size, void const * const ptr) {
-    unsigned char *b = (unsigned char*) ptr;
-    unsigned char byte;
-    int i, j;
+        newNode = initQTreeNode(self);
+        nodes[newNode].weight = nodes[children[0]].weight + nodes[children[1]].weight;
+        nodes[newNode].lchild = children[0];
+        nodes[newNode].rchild = children[1];
 
-    for (i=size-1; i >= 0; i--) {
-        for (j=7; j >= 0; j--) {
-            byte = b[i] & (1<<j);
-            byte >>= j;
-            printf("%u", byte);
-        }
+        merged[numberOfMerged++] = newNode;
     }
+
+    self->root = merged[numberOfMerged - 1];
+
+    return true;
 }
 
 static uint32_t reverse_bits(uint32_t v, uint32_t codeLength) {
@@ -181,306 +255,2292 @@ static uint32_t reverse_bits(uint32_t v, uint32_t codeLength) {
     return r;
 }
 
-static inline void visitNode(qtreeNode* root, uint8_t depth,
-                        uint32_t code, codeInfo codes[]) {
+static inline void visitNode(qtreeNode* root, uint8_t depth, codeInfo codes[]) {
+    if (root->isLeaf) {
+        codes[root->symb] = (codeInfo){root->symb, depth, 0};
+    }
+}
+
+static void traverseTree(ARCH* self, uint16_t root, void (*visitNode)(qtreeNode*, uint8_t, codeInfo[]),
+                            uint8_t depth, codeInfo codes[]) {
+    if (root != NO_NODE) {
+        visitNode(&(self->nodes[root]), depth, codes);
 
-    uint32_t reversedCode;
-    if (root->symb) {
-        reversedCode = reverse_bits(code, depth);
-        codes[root->symb] = (codeInfo){root->symb, depth, reversedCode};
+        traverseTree(self, self->nodes[root].lchild, visitNode, depth + 1, codes);
+        traverseTree(self, self->nodes[root].rchild, visitNode, depth + 1, codes);
     }
 }
 
-static void traverseTree(qtreeNode* root, void (*visitNode)(qtreeNode*, uint8_t, uint32_t, codeInfo[]),
-                            uint8_t depth, uint32_t code, codeInfo codes[]) {
-    if (root) {
-        visitNode(root, depth, code, codes);
-        
-        code = code << 1;
-        traverseTree(root->lchild, visitNode, depth + 1, code | 0, codes);
-        traverseTree(root->rchild, visitNode, depth + 1, code | 1, codes);
+static int compareWeights(const void* a, const void* b) {
+    const symbolWeight *first = (const symbolWeight*) a;
+    const symbolWeight *second = (const symbolWeight*) b;
+
+    if (first->weight != second->weight) {
+        return (first->weight < second->weight) ? 1 : -1;
     }
+
+    return (int)first->symb - (int)second->symb;
 }
 
-static bool generateCodeTable(ARCH* self) {
-    codeInfo *codeTable = self->codes;
-    traverseTree(self->root, visitNode, (uint8_t)0, (uint32_t)0, self->codes);
+/*
+This function caps the code lengths taken from the tree at MAX_CODE_LENGTH.
+It works on the number of codes of every length (JPEG Annex K.3): two
+codes from the deepest level are lifted, one into the level above and the
+other as a sibling of a shorter code that is pushed one level down. The
+counts keep describing a complete prefix code, and the lengths are then
+handed out again so that the most frequent symbols get the shortest codes.
+*/
+static void limitCodeLengths(ARCH* self, codeInfo codes[]) {
+    uint32_t lengthCount[256] = {0};
+    uint32_t maxLength = 0;
+    uint32_t i, j;
 
-    for (int i = 0; i < 256; ++i) {
-        if ((codeTable[i].length) > 0) {
-            (self->numberOfCodes)++;
+    for (i = 0; i < 256; ++i) {
+        if (codes[i].length > 0) {
+            lengthCount[codes[i].length]++;
+
+            if (codes[i].length > maxLength) {
+                maxLength = codes[i].length;
+            }
         }
     }
 
-    return 0;
+    if (maxLength <= MAX_CODE_LENGTH) {
+        return;
+    }
+
+    for (i = maxLength; i > MAX_CODE_LENGTH; --i) {
+        while (lengthCount[i] > 0) {
+            j = i - 2;
+
+            while (lengthCount[j] == 0) {
+                j--;
+            }
+
+            lengthCount[i] -= 2;
+            lengthCount[i - 1]++;
+            lengthCount[j + 1] += 2;
+            lengthCount[j]--;
+        }
+    }
+
+    /* the leaves are still sorted by rising weight */
+    for (i = self->numberOfLeaves, j = 1; i-- > 0;) {
+        while (lengthCount[j] == 0) {
+            j++;
+        }
+
+        codes[self->nodes[self->leaves[i]].symb].length = j;
+        lengthCount[j]--;
+    }
 }
 
-static bool writeCodesToFile(ARCH* self, const char* dstFileName) {
-    codeInfo codes[self->numberOfCodes];
-    codeInfo *codeTable = self->codes;
+/*
+This function derives canonical codes from the code lengths alone: codes
+of one length are consecutive numbers in symbol order, and every length
+starts right after the codes of the previous one. Both sides call it, so
+only the lengths have to be stored. The codes are bit-reversed because the
+stream is filled from the least significant bit. Returns false when the
+lengths cannot form a prefix code.
+*/
+static bool assignCanonicalCodes(codeInfo codes[]) {
+    uint32_t lengthCount[MAX_CODE_LENGTH + 1] = {0};
+    uint32_t nextCode[MAX_CODE_LENGTH + 1] = {0};
+    uint32_t kraftSum = 0;
+    uint32_t code = 0;
+    uint32_t i;
 
-    FILE *dstFile = fopen(dstFileName, "w+");
+    for (i = 0; i < 256; ++i) {
+        if (codes[i].length > MAX_CODE_LENGTH) {
+            return false;
+        }
 
-    for (int i = 0, j = 0; i < 256; ++i) {
-        if ((codeTable[i].length) > 0) {
-            codes[j++] = codeTable[i];
+        if (codes[i].length > 0) {
+            lengthCount[codes[i].length]++;
+            kraftSum += 1u << (MAX_CODE_LENGTH - codes[i].length);
         }
     }
 
-    self->archInfo.tableLength = self->numberOfCodes;
-    fseek(dstFile, sizeof(archiveInfo), SEEK_SET);    
-    fwrite(codes, sizeof(codeInfo), self->numberOfCodes, dstFile);
+    if (kraftSum > (1u << MAX_CODE_LENGTH)) {
+        return false;
+    }
+
+    for (i = 1; i <= MAX_CODE_LENGTH; ++i) {
+        code = (code + lengthCount[i - 1]) << 1;
+        nextCode[i] = code;
+    }
+
+    for (i = 0; i < 256; ++i) {
+        codes[i].character = (uint8_t)i;
 
-    fclose(dstFile);
+        if (codes[i].length > 0) {
+            codes[i].code = reverse_bits(nextCode[codes[i].length]++, codes[i].length);
+        } else {
+            codes[i].code = 0;
+        }
+    }
 
     return true;
 }
 
-static bool writeDataToFile(ARCH* self, const char* dstFileName, const char* srcFileName) {
+static bool generateCodeTable(ARCH* self) {
+    codeInfo *codeTable = self->codes;
+    traverseTree(self, self->root, visitNode, (uint8_t)0, self->codes);
+
+    limitCodeLengths(self, codeTable);
+    assignCanonicalCodes(codeTable);
+
+    for (int i = 0; i < 256; ++i) {
+        self->encodeTable[i] = packCode(codeTable[i].code, codeTable[i].length);
+    }
 
-    FILE *dstFile = fopen(dstFileName, "a+");
-    FILE *srcFile = fopen(srcFileName, "r");
+    return 0;
+}
 
+/*
+The table is stored as code lengths only, two 4-bit lengths per byte for
+the symbols from <firstSymbol> to <lastSymbol>, the range that has codes.
+Returns the number of bytes used in <packedLengths>.
+*/
+static uint32_t packCodeLengths(ARCH* self, blockInfo* info, uint8_t packedLengths[]) {
     codeInfo *codeTable = self->codes;
-    uint8_t readBuff[BUFFER_SIZE];
-    uint8_t nextReadedCharAsciiCode;
-    uint8_t nextReadedCharCodeLength;
-
-    uint32_t writeBuff[BUFFER_SIZE] = {0};
-    uint32_t readedChars;
-    uint32_t tempCode_1 = 0, tempCode_2 = 0;
-    uint32_t writedBlocks = 0;
+    uint32_t firstSymbol = 256, lastSymbol = 0;
+    uint32_t packedSize;
     uint32_t i;
 
-    int32_t freeBlocks = BUFFER_SIZE, freeBits = BITS_IN_BLOCK;
-    int32_t availableBits = 0;
-
-    while ((freeBlocks) > 0) {
-        if ((bool)(readedChars = fread(readBuff, sizeof(uint8_t), BUFFER_SIZE, srcFile))) {
-
-            for (i = 0; i < readedChars; i++) {
-                nextReadedCharAsciiCode = readBuff[i];
-                nextReadedCharCodeLength = codeTable[nextReadedCharAsciiCode].length;
-
-                availableBits = freeBits - nextReadedCharCodeLength;
-
-                if (availableBits > 0) {
-                    tempCode_1 = codeTable[nextReadedCharAsciiCode].code;
-                    tempCode_1 <<= (BITS_IN_BLOCK - freeBits);
-                    //write code of another readed character
-                    writeBuff[BUFFER_SIZE - freeBlocks] |= tempCode_1;
-
-                    freeBits -= nextReadedCharCodeLength;
-                } else {
-                    tempCode_1 = (codeTable[nextReadedCharAsciiCode].code << (BITS_IN_BLOCK - nextReadedCharCodeLength + abs(availableBits)));
-                    tempCode_2 = (codeTable[nextReadedCharAsciiCode].code >> freeBits);
-                    freeBits = BITS_IN_BLOCK + availableBits;
-                    writeBuff[BUFFER_SIZE - freeBlocks] |= tempCode_1;
-                    freeBlocks--;
-               
-                    if (freeBlocks == 0) {
-                        fwrite(writeBuff, sizeof(uint32_t), BUFFER_SIZE, dstFile);
-                        writedBlocks++;
-                        memset(writeBuff, 0, sizeof(writeBuff));
-                        
-                        freeBlocks = BUFFER_SIZE;
-                        freeBits = BITS_IN_BLOCK;
-                
-                        if (i >= readedChars) 
-                            break;
-                        
-                        i--;
-                    } else {
-                        writeBuff[BUFFER_SIZE - freeBlocks] |= tempCode_2;
-                    }
-                }
-            }
-        } else {
-            if (freeBlocks - 1 < BUFFER_SIZE) {
-                fwrite(writeBuff, sizeof(uint32_t), BUFFER_SIZE - freeBlocks + 1, dstFile);
-                writedBlocks++;
+    for (i = 0; i < 256; ++i) {
+        if ((codeTable[i].length) > 0) {
+            if (firstSymbol == 256) {
+                firstSymbol = i;
             }
 
-            self->archInfo.remainingBits = (sizeof(writeBuff) * 8) - (((freeBlocks - 1) * BITS_IN_BLOCK) + freeBits);
-            self->archInfo.numberOfBlocks = writedBlocks;
-            break;
+            lastSymbol = i;
         }
     }
 
-    fclose(srcFile);
-    fclose(dstFile);
+    if (firstSymbol == 256) {
+        firstSymbol = 0;
+    }
+
+    packedSize = (lastSymbol - firstSymbol) / 2 + 1;
+    memset(packedLengths, 0, packedSize);
 
-    return true;
+    for (i = firstSymbol; i <= lastSymbol; ++i) {
+        packedLengths[(i - firstSymbol) / 2] |= codeTable[i].length << (((i - firstSymbol) & 1) * 4);
+    }
+
+    info->firstSymbol = firstSymbol;
+    info->lastSymbol = lastSymbol;
+
+    return packedSize;
 }
 
-static bool writeArchiveInfo(ARCH* self, const char* dstFileName) {
-    FILE* dstFile = fopen(dstFileName, "r+");
+/*
+This function codes the <rawSize> bytes of a block at <srcBuff> into
+<dstBuff> and sets <streams> and <dataSize> of <info>. Blocks of
+INTERLEAVE_MIN_SIZE bytes or more are cut into NUMBER_OF_STREAMS
+contiguous quarters coded as separate streams one after the other, and
+the jump table is filled in last. Every stream pads to whole words, so
+<dstBuff> needs 8 bytes of slack past BLOCK_WORDS(<rawSize>). The streams
+are coded by the kernel chosen for this processor. A stored block is
+copied as it is, and so is a block repeating a table that turns out to
+code it into more bytes than it has: it stores no table, so nothing that
+follows depends on it.
+*/
+static void encodeBlockData(ARCH* self, blockInfo* info, const uint16_t encodeTable[], const uint8_t* srcBuff,
+                            void* dstBuff) {
+    uint8_t *dst = (uint8_t*) dstBuff;
+    uint32_t jumpTable[JUMP_WORDS];
+    uint32_t segment = (info->rawSize + NUMBER_OF_STREAMS - 1) / NUMBER_OF_STREAMS;
+    uint32_t words = JUMP_WORDS;
+    uint32_t streamWords, start;
+    stageTimer timer;
+
+    startStage(&(self->stats), &timer);
+
+    if (info->type == BLOCK_STORED) {
+        storeBlockData(info, srcBuff, dst);
+        stopStage(&(self->stats), STAGE_ENCODE, &timer, info->rawSize);
+        return;
+    }
+
+    if (info->rawSize < INTERLEAVE_MIN_SIZE) {
+        info->streams = 1;
+        words = self->encodeData(encodeTable, srcBuff, info->rawSize, dst);
+    } else {
+        info->streams = NUMBER_OF_STREAMS;
 
-    fseek(dstFile, 0, SEEK_SET);
-    fwrite(&(self->archInfo), sizeof(archiveInfo), 1, dstFile);
+        for (uint32_t i = 0; i < NUMBER_OF_STREAMS; ++i) {
+            start = i * segment;
+            streamWords = self->encodeData(encodeTable, srcBuff + start,
+                                           (info->rawSize - start < segment) ? info->rawSize - start : segment,
+                                           dst + (size_t)words * sizeof(uint32_t));
 
-    fclose(dstFile);
+            if (i < JUMP_WORDS) {
+                jumpTable[i] = streamWords;
+            }
 
-    return true;
+            words += streamWords;
+        }
+
+        memcpy(dst, jumpTable, sizeof(jumpTable));
+    }
+
+    info->dataSize = words * sizeof(uint32_t);
+
+    if (info->type == BLOCK_REPEAT && info->dataSize > info->rawSize) {
+        info->type = BLOCK_STORED;
+        storeBlockData(info, srcBuff, dst);
+    }
+
+    stopStage(&(self->stats), STAGE_ENCODE, &timer, info->rawSize);
 }
 
-bool compress(ARCH* self, const char* dstFileName, const char* srcFileName) {
-    buildQueue(self, srcFileName);
+static void storeBlockData(blockInfo* info, const uint8_t* srcBuff, uint8_t* dstBuff) {
+    info->streams = 0;
+    info->dataSize = info->rawSize;
+    memcpy(dstBuff, srcBuff, info->rawSize);
+}
+
+/*
+First half of coding a block: count it and derive the code table that
+suits it best. It touches nothing but <self> and <job>, so blocks can be
+analyzed on any thread and in any order.
+*/
+static void analyzeBlock(ARCH* self, blockJob* job) {
+    stageTimer timer;
+
+    resetTree(self);
+
+    startStage(&(self->stats), &timer);
+    buildQueue(self, job->rawData, job->info.rawSize);
+    stopStage(&(self->stats), STAGE_BUILD_QUEUE, &timer, job->info.rawSize);
+
+    startStage(&(self->stats), &timer);
     buildTree(self);
+    stopStage(&(self->stats), STAGE_BUILD_TREE, &timer, 0);
+
+    startStage(&(self->stats), &timer);
     generateCodeTable(self);
-    writeCodesToFile(self, dstFileName);
-    writeDataToFile(self, dstFileName, srcFileName);
-    writeArchiveInfo(self, dstFileName);
-    return true;
-}
+    stopStage(&(self->stats), STAGE_CODE_TABLE, &timer, 0);
 
-bool decompress(ARCH* self, const char* dstFileName, const char* srcFileName) {
-    FILE *dstFile = fopen(dstFileName, "w+");
-    FILE *srcFile = fopen(srcFileName, "r");
+    self->stats.treeNodes += self->numberOfNodes;
+
+    for (uint32_t i = 0; i < 256; ++i) {
+        job->frequencies[i] = (uint32_t)self->frequencies[i];
+        job->codeLengths[i] = self->codes[i].length;
+    }
 
-    readArchiveInfo(self, srcFile);
-    rebuildTree(self, srcFile);
-    decodeFile(self, dstFile, srcFile);
-    
-    fclose(dstFile);
-    fclose(srcFile);
+    memcpy(job->encodeTable, self->encodeTable, sizeof(job->encodeTable));
 
-    return true;
+    job->info.type = BLOCK_HUFFMAN;
+    job->packedSize = packCodeLengths(self, &(job->info), job->packedLengths);
 }
 
-static bool readArchiveInfo(ARCH* self, FILE* srcFile) {
-    if(fread(&(self->archInfo), sizeof(archiveInfo), 1, srcFile)) {
-        return true;
+static void analyzeBlockTask(void* arg, uint32_t worker, uint32_t job) {
+    encodeTask *task = (encodeTask*) arg;
+
+    analyzeBlock(task->contexts[worker], &(task->jobs[job]));
+}
+
+/*
+This function decides, in stream order, whether a block stores its own
+table, repeats the one in effect or is stored as it is. The sizes are
+estimated from the block's histogram: its own table costs the packed
+lengths on top of the optimal bits, the table in effect costs nothing to
+store but may code the block worse, and cannot be used at all if it lacks
+one of its symbols. When neither beats the raw bytes, as on data that is
+already compressed, the block is stored, which also makes it a copy to
+decode.
+*/
+static void chooseBlockTable(ARCH* self, blockJob* job) {
+    activeTable *current = &(self->currentTable);
+    uint64_t ownBits = 0, repeatBits = 0;
+    uint64_t ownSize, repeatSize;
+    bool canRepeat = current->isValid;
+    bool doesRepeat;
+
+    for (uint32_t i = 0; i < 256; ++i) {
+        if (job->frequencies[i] > 0) {
+            ownBits += (uint64_t)job->frequencies[i] * job->codeLengths[i];
+            repeatBits += (uint64_t)job->frequencies[i] * current->codeLengths[i];
+            canRepeat = canRepeat && current->codeLengths[i] > 0;
+        }
+    }
+
+    ownSize = job->packedSize + (ownBits + BITS_IN_BLOCK - 1) / BITS_IN_BLOCK * sizeof(uint32_t);
+    repeatSize = (repeatBits + BITS_IN_BLOCK - 1) / BITS_IN_BLOCK * sizeof(uint32_t);
+    doesRepeat = canRepeat && repeatSize <= ownSize;
+
+    if (job->info.rawSize <= (doesRepeat ? repeatSize : ownSize)) {
+        if (self->stats.enabled) {
+            recordBlockStats(self, job, (uint64_t)job->info.rawSize * 8);
+        }
+
+        storeBlock(job);
+        return;
+    }
+
+    if (self->stats.enabled) {
+        recordBlockStats(self, job, doesRepeat ? repeatBits : ownBits);
+    }
+
+    if (doesRepeat) {
+        job->info.type = BLOCK_REPEAT;
+        job->info.firstSymbol = 0;
+        job->info.lastSymbol = 0;
+        job->packedSize = 0;
+        memcpy(job->encodeTable, current->encodeTable, sizeof(job->encodeTable));
     } else {
-        return false;
+        memcpy(current->codeLengths, job->codeLengths, sizeof(current->codeLengths));
+        memcpy(current->encodeTable, job->encodeTable, sizeof(current->encodeTable));
+        current->isValid = true;
     }
 }
 
-static bool decodeFile(ARCH* self, FILE* dstFile, FILE* srcFile) {
-    register uint32_t currentBitMask = 1;
-    
-    int32_t  remainingSignificantBits = self->archInfo.remainingBits;
-    uint8_t  writeBuff[BUFFER_SIZE * 16] = {0};
-    uint32_t readBuff[BUFFER_SIZE] = {0};
-    uint32_t currentWriteBuffByte = 0;
-    uint32_t readedBlocksNumber = 0;
-    uint32_t totalReadedBlocks = 0;
-    uint32_t currentBlock = 0;
-    bool     isLastBlock = false;
+/*
+A stored block needs no table and leaves the one in effect alone.
+*/
+static void storeBlock(blockJob* job) {
+    job->info.type = BLOCK_STORED;
+    job->info.firstSymbol = 0;
+    job->info.lastSymbol = 0;
+    job->packedSize = 0;
+}
+
+/*
+This function builds <table>, the one table of a sampled compression,
+from the <counts> of a sample of the source. The bytes the sample missed
+must still get a code, so they count as seen once in every
+2^MAX_CODE_LENGTH bytes of it, which is about what a code of the longest
+length is worth. A smaller count would make the tree much deeper than
+that and leave limitCodeLengths() to take the room back from the
+frequent symbols. If the table would not code the sample into fewer bytes
+than it has, <table> is marked stored instead.
+*/
+static void buildSampledTable(ARCH* self, const uint64_t counts[], blockJob* table) {
+    uint64_t total = 0, codedBits = 0;
+    uint64_t unseen;
+    stageTimer timer;
 
-    qtreeNode* cNodePtr = self->root;
+    resetTree(self);
 
-    while ((bool)(readedBlocksNumber = fread(readBuff, sizeof(uint32_t), BUFFER_SIZE, srcFile))) {
-        if (++totalReadedBlocks == self->archInfo.numberOfBlocks) {
-            isLastBlock = true;
-        }
+    for (uint32_t i = 0; i < 256; ++i) {
+        total += counts[i];
+    }
 
-        cNodePtr = self->root;
+    unseen = (total >> MAX_CODE_LENGTH > 0) ? total >> MAX_CODE_LENGTH : 1;
 
-        for (currentBlock = 0; currentBlock < readedBlocksNumber; ++currentBlock) {
-            currentBitMask = 1;
-            
-            while (currentBitMask) {
+    for (uint32_t i = 0; i < 256; ++i) {
+        self->frequencies[i] = (counts[i] > 0) ? counts[i] : unseen;
+    }
 
-                if (cNodePtr->symb != 0) {
-                    writeBuff[currentWriteBuffByte] = cNodePtr->symb;
-                    currentWriteBuffByte++; 
+    queueSymbols(self);
 
-                    cNodePtr = self->root;
+    startStage(&(self->stats), &timer);
+    buildTree(self);
+    stopStage(&(self->stats), STAGE_BUILD_TREE, &timer, 0);
 
-                    if (currentWriteBuffByte == (BUFFER_SIZE * 16)) {
-                        fwrite(writeBuff, sizeof(uint8_t), BUFFER_SIZE * 16, dstFile);
-                        memset(writeBuff, 0, sizeof(writeBuff));
-                        currentWriteBuffByte = 0;
-                    }
-                }
+    startStage(&(self->stats), &timer);
+    generateCodeTable(self);
+    stopStage(&(self->stats), STAGE_CODE_TABLE, &timer, 0);
 
-                cNodePtr = (readBuff[currentBlock] & currentBitMask) ? cNodePtr->rchild : cNodePtr->lchild;
+    for (uint32_t i = 0; i < 256; ++i) {
+        table->codeLengths[i] = self->codes[i].length;
+        codedBits += counts[i] * self->codes[i].length;
+    }
 
-/*                if (cNodePtr == NULL) {
-                    printf("OLOLOL\n");
-                    goto finish;
-                }*/
+    memcpy(table->encodeTable, self->encodeTable, sizeof(table->encodeTable));
 
-                currentBitMask <<= 1;
+    table->info = (blockInfo){0};
+    table->info.type = BLOCK_HUFFMAN;
+    table->packedSize = packCodeLengths(self, &(table->info), table->packedLengths);
 
-                if (isLastBlock) {
-                    remainingSignificantBits--;
-                    if (remainingSignificantBits < 0) {
-                        goto finish;
-                    }
-                }
-            }
+    if (codedBits >= total * 8) {
+        table->info.type = BLOCK_STORED;
+    }
+}
+
+/*
+In a sampled compression, blocks are not counted and all of them are
+coded with the sampled <table>: the first block stores it and the others
+repeat it, or all of them are stored if <table> is. With statistics on,
+the blocks were analyzed all the same, so the bits their own tables would
+have spent are recorded next to the bits the sampled table spends.
+*/
+static void useSampledTable(ARCH* self, const blockJob* table, blockJob* job) {
+    activeTable *current = &(self->currentTable);
+    uint64_t ownBits = 0, sampledBits = 0;
+    uint64_t rawBits = (uint64_t)job->info.rawSize * 8;
+
+    if (self->stats.enabled) {
+        for (uint32_t i = 0; i < 256; ++i) {
+            ownBits += (uint64_t)job->frequencies[i] * job->codeLengths[i];
+            sampledBits += (uint64_t)job->frequencies[i] * table->codeLengths[i];
         }
 
-        memset(readBuff, 0, sizeof(readBuff));
+        recordBlockStats(self, job, (table->info.type == BLOCK_STORED) ? rawBits : sampledBits);
+        self->stats.exactBits += (ownBits < rawBits) ? ownBits : rawBits;
     }
 
-finish:
+    if (table->info.type == BLOCK_STORED) {
+        storeBlock(job);
+        return;
+    }
 
-    if(currentWriteBuffByte > 0) {
-        fwrite(writeBuff, sizeof(uint8_t), currentWriteBuffByte, dstFile);
+    if (current->isValid && memcmp(current->codeLengths, table->codeLengths, sizeof(current->codeLengths)) == 0) {
+        job->info.type = BLOCK_REPEAT;
+        job->info.firstSymbol = 0;
+        job->info.lastSymbol = 0;
+        job->packedSize = 0;
+    } else {
+        job->info.type = BLOCK_HUFFMAN;
+        job->info.firstSymbol = table->info.firstSymbol;
+        job->info.lastSymbol = table->info.lastSymbol;
+        job->packedSize = table->packedSize;
+        memcpy(job->packedLengths, table->packedLengths, table->packedSize);
+        memcpy(current->codeLengths, table->codeLengths, sizeof(current->codeLengths));
+        memcpy(current->encodeTable, table->encodeTable, sizeof(current->encodeTable));
+        current->isValid = true;
     }
 
-    return true;
+    memcpy(job->encodeTable, table->encodeTable, sizeof(job->encodeTable));
 }
 
-static void rebuildNodes(qtreeNode* root, uint8_t length, uint32_t code, uint8_t symb) {
-    qtreeNode *newNode = initQTreeNode();
+/*
+This function adds a coded block to the statistics: the bits its table
+spends on it and the order-0 entropy of the block, the least any code
+table could spend.
+*/
+static void recordBlockStats(ARCH* self, const blockJob* job, uint64_t codedBits) {
+    double length = (double)job->info.rawSize;
+    double probability;
+
+    for (uint32_t i = 0; i < 256; ++i) {
+        if (job->frequencies[i] > 0) {
+            probability = job->frequencies[i] / length;
+            self->stats.entropyBits -= job->frequencies[i] * log2(probability);
+        }
+    }
 
-    if(length > 0) {
-        if (code & 1) {
-            if (root->rchild == NULL) 
-                root->rchild = newNode;
+    self->stats.blocks++;
+    self->stats.rawBytes += job->info.rawSize;
+    self->stats.codedBits += codedBits;
+}
 
-            rebuildNodes(root->rchild, length - 1, code >> 1, symb);
-        } else {
-            if (root->lchild == NULL) 
-                root->lchild = newNode;
+/*
+Second half of coding a block: code it with the table chosen for it.
+*/
+static void encodeBlock(ARCH* self, blockJob* job) {
+    encodeBlockData(self, &(job->info), job->encodeTable, job->rawData, job->encodedBuff);
+}
 
-            rebuildNodes(root->lchild, length - 1, code >> 1, symb);
+static void encodeBlockTask(void* arg, uint32_t worker, uint32_t job) {
+    encodeTask *task = (encodeTask*) arg;
+
+    encodeBlock(task->contexts[worker], &(task->jobs[job]));
+}
+
+/*
+This function writes a coded block right after whatever was written
+before, so the archive is produced in one pass.
+*/
+static bool writeBlockToFile(ARCH* self, const blockJob* job, FILE* dstFile) {
+    return writeData(self, &(job->info), sizeof(blockInfo), dstFile) &&
+           writeData(self, job->packedLengths, job->packedSize, dstFile) &&
+           writeData(self, job->encodedBuff, job->info.dataSize, dstFile);
+}
+
+static bool addIndexEntry(ARCH* self, uint64_t archiveOffset, uint64_t rawOffset, uint64_t tableOffset) {
+    indexEntry *blockIndex;
+
+    if (self->numberOfBlocks == self->indexCapacity) {
+        blockIndex = (indexEntry*) realloc(self->blockIndex,
+                                           2 * (self->indexCapacity + 1) * sizeof(indexEntry));
+
+        if (blockIndex == NULL) {
+            return false;
         }
-    } else {
-        root->symb = symb;
+
+        self->blockIndex = blockIndex;
+        self->indexCapacity = 2 * (self->indexCapacity + 1);
     }
+
+    self->blockIndex[self->numberOfBlocks++] = (indexEntry){archiveOffset, rawOffset, tableOffset};
+
+    return true;
+}
+
+/*
+The index is written after the end of the stream, so it can be produced
+in the same sequential pass; the fixed-size trailer at the very end of
+the archive tells a reader where it starts. An empty source has no index
+to write, only the trailer.
+*/
+static bool writeArchiveIndex(ARCH* self, uint64_t indexOffset, uint64_t rawSize, FILE* dstFile) {
+    archiveTrailer trailer = {indexOffset, rawSize, self->numberOfBlocks, ARCHIVE_MAGIC};
+
+    return (self->numberOfBlocks == 0 ||
+            writeData(self, self->blockIndex, self->numberOfBlocks * sizeof(indexEntry), dstFile)) &&
+           writeData(self, &trailer, sizeof(archiveTrailer), dstFile);
+}
+
+static bool writeArchiveInfo(ARCH* self, uint32_t magic, FILE* dstFile) {
+    self->archInfo.magic = magic;
+    self->archInfo.blockSize = ARCHIVE_BLOCK_SIZE;
+
+    return writeData(self, &(self->archInfo), sizeof(archiveInfo), dstFile);
 }
 
-static bool rebuildTree(ARCH* self, FILE *srcFile) {
-    uint8_t numberOfCodes = self->archInfo.tableLength;
-    uint8_t readedCodesNum;
-    codeInfo codes[numberOfCodes];
+/*
+This function sets up the contexts and rings of <pipeline> over the
+first PIPELINE_DEPTH batches of <batchSize> jobs of <self> and starts
+its reader and writer threads. Fields the loops need beyond these are
+set by the caller beforehand.
+*/
+static bool startPipeline(blockPipeline* pipeline, ARCH* self, FILE* dstFile, FILE* srcFile, uint32_t batchSize,
+                          void* (*readLoop)(void*), void* (*writeLoop)(void*)) {
+    pipeline->self = self;
+    pipeline->dstFile = dstFile;
+    pipeline->srcFile = srcFile;
+    pipeline->batchSize = batchSize;
+    pipeline->reader = initArch();
+    pipeline->writer = initArch();
+    pipeline->empty = initRingBuffer(PIPELINE_DEPTH);
+    pipeline->filled = initRingBuffer(PIPELINE_DEPTH);
+    pipeline->coded = initRingBuffer(PIPELINE_DEPTH);
+
+    if (pipeline->reader == NULL || pipeline->writer == NULL || pipeline->empty == NULL ||
+        pipeline->filled == NULL || pipeline->coded == NULL) {
+        releasePipeline(pipeline);
+        return false;
+    }
+
+    pipeline->reader->stats.enabled = self->stats.enabled;
+    pipeline->writer->stats.enabled = self->stats.enabled;
+
+    for (uint32_t i = 0; i < PIPELINE_DEPTH; ++i) {
+        pipeline->batches[i] = (blockBatch){self->jobs + (size_t)i * batchSize, 0};
+        pushRingBuffer(pipeline->empty, &(pipeline->batches[i]));
+    }
 
-    if(!(bool)(readedCodesNum = fread(codes, sizeof(codeInfo), numberOfCodes, srcFile))) {
+    if (pthread_create(&(pipeline->readerThread), NULL, readLoop, pipeline) != 0) {
+        releasePipeline(pipeline);
         return false;
     }
 
-    self->root = initQTreeNode();
-    
-    for (int i = numberOfCodes - 1; i >= 0; --i) {
-        rebuildNodes(self->root, codes[i].length, codes[i].code, codes[i].character);
+    if (pthread_create(&(pipeline->writerThread), NULL, writeLoop, pipeline) != 0) {
+        failPipeline(pipeline);
+        pthread_join(pipeline->readerThread, NULL);
+        releasePipeline(pipeline);
+        return false;
     }
 
     return true;
 }
 
-static qtreeNode* initQTreeNode(void) {
-    qtreeNode *newElement = (qtreeNode*) malloc(sizeof(qtreeNode));
- 
-    newElement->rchild = NULL;
-    newElement->lchild = NULL;
-    newElement->nextNode = NULL;
-    newElement->symb = 0;
+/*
+This function ends a pipeline once the calling thread has coded the last
+batch: it lets the writer drain, waits for both threads and hands their
+statistics over to the owner. It tells whether every stage succeeded.
+*/
+static bool stopPipeline(blockPipeline* pipeline) {
+    closeRingBuffer(pipeline->coded);
+    pthread_join(pipeline->readerThread, NULL);
+    pthread_join(pipeline->writerThread, NULL);
+
+    mergeStats(&(pipeline->self->stats), &(pipeline->reader->stats));
+    mergeStats(&(pipeline->self->stats), &(pipeline->writer->stats));
+    releasePipeline(pipeline);
 
-    return newElement;
+    return !pipeline->failed;
 }
 
-ARCH* initArch(void) {
-    ARCH *self = (ARCH*) calloc(1, sizeof(ARCH));
-    self->numberOfCodes = 0;
-    self->progress = (uint8_t*) calloc(1, sizeof(uint8_t));
-    self->head = NULL;
-    self->tail = NULL;
-    self->root = NULL;
+/*
+Any stage that fails closes every ring, which wakes and stops the others.
+*/
+static void failPipeline(blockPipeline* pipeline) {
+    __atomic_store_n(&(pipeline->failed), true, __ATOMIC_RELAXED);
+    closeRingBuffer(pipeline->empty);
+    closeRingBuffer(pipeline->filled);
+    closeRingBuffer(pipeline->coded);
+}
 
-    return self;
-}
\ No newline at end of file
+static bool hasPipelineFailed(blockPipeline* pipeline) {
+    return __atomic_load_n(&(pipeline->failed), __ATOMIC_RELAXED);
+}
+
+static void releasePipeline(blockPipeline* pipeline) {
+    freeArch(pipeline->reader);
+    freeArch(pipeline->writer);
+    freeRingBuffer(pipeline->empty);
+    freeRingBuffer(pipeline->filled);
+    freeRingBuffer(pipeline->coded);
+    pipeline->reader = pipeline->writer = NULL;
+    pipeline->empty = pipeline->filled = pipeline->coded = NULL;
+}
+
+/*
+The reader of a compression cuts the source into blocks, from its mapping
+when it has one, until a batch comes out short.
+*/
+static void* encodeReadLoop(void* arg) {
+    blockPipeline *pipeline = (blockPipeline*) arg;
+    blockBatch *batch;
+    blockJob *job;
+    bool atEnd = false;
+
+    while (!atEnd && (batch = (blockBatch*) popRingBuffer(pipeline->empty)) != NULL) {
+        for (batch->numberOfJobs = 0; batch->numberOfJobs < pipeline->batchSize; ++(batch->numberOfJobs)) {
+            job = &(batch->jobs[batch->numberOfJobs]);
+            job->info = (blockInfo){0};
+
+            if (pipeline->srcMap.data) {
+                job->info.rawSize = (pipeline->srcMap.size - pipeline->position < ARCHIVE_BLOCK_SIZE)
+                                    ? (uint32_t)(pipeline->srcMap.size - pipeline->position) : ARCHIVE_BLOCK_SIZE;
+                job->rawData = pipeline->srcMap.data + pipeline->position;
+                pipeline->position += job->info.rawSize;
+            } else {
+                job->info.rawSize = readData(pipeline->reader, job->rawBuff, ARCHIVE_BLOCK_SIZE, pipeline->srcFile);
+                job->rawData = job->rawBuff;
+            }
+
+            if (job->info.rawSize == 0) {
+                break;
+            }
+        }
+
+        atEnd = batch->numberOfJobs < pipeline->batchSize;
+
+        if (batch->numberOfJobs > 0 && !pushRingBuffer(pipeline->filled, batch)) {
+            break;
+        }
+    }
+
+    if (pipeline->srcMap.data == NULL && ferror(pipeline->srcFile)) {
+        failPipeline(pipeline);
+    }
+
+    closeRingBuffer(pipeline->filled);
+
+    return NULL;
+}
+
+static void* encodeWriteLoop(void* arg) {
+    blockPipeline *pipeline = (blockPipeline*) arg;
+    blockBatch *batch;
+    blockJob *job;
+
+    while ((batch = (blockBatch*) popRingBuffer(pipeline->coded)) != NULL) {
+        for (uint32_t i = 0; i < batch->numberOfJobs && !hasPipelineFailed(pipeline); ++i) {
+            job = &(batch->jobs[i]);
+
+            if (!writeBlockToFile(pipeline->writer, job, pipeline->dstFile)) {
+                failPipeline(pipeline);
+                break;
+            }
+
+            addProgress(&(pipeline->self->progress), job->info.rawSize);
+        }
+
+        pushRingBuffer(pipeline->empty, batch);
+    }
+
+    return NULL;
+}
+
+/*
+This function codes <srcFile> to its end as blocks appended to <dstFile>
+at <archiveOffset>, adding each block to the index. The source is read
+exactly once, one batch of blocks at a time, by the reader of a
+pipeline, and the coded batches are written by its writer, so reading
+and writing overlap the coding of the batches in between. The blocks of
+a batch are analyzed in parallel, then, in stream order, each one either
+keeps its own table or repeats the one in effect, and finally they are
+coded in parallel from the same buffers. None of these choices depends
+on how blocks are spread over threads, so neither does the archive. A
+regular source is mapped instead and its blocks are coded in place.
+With <sampleTables>, the blocks are not analyzed but all coded with one
+table built from a sample of the source: of all of it when it is mapped,
+else of its first SAMPLE_STREAM_BLOCKS blocks, which the first batch
+holds for any number of threads, so the table does not depend on it.
+*/
+static bool writeBlocks(ARCH* self, FILE* dstFile, FILE* srcFile, uint64_t* archiveOffset, uint64_t* rawOffset) {
+    blockPipeline pipeline = {0};
+    blockBatch *batch;
+    blockJob *jobs;
+    blockJob sampledTable;
+    uint64_t counts[256] = {0};
+    uint64_t start = 0;
+    bool hasSampledTable = false;
+    uint32_t batchSize;
+    uint32_t numberOfJobs;
+    uint32_t sampledJobs;
+    uint32_t i;
+    encodeTask task;
+    bool result;
+
+    if (!reserveWorkers(self)) {
+        return false;
+    }
+
+    batchSize = self->numberOfWorkers * BATCH_BLOCKS_PER_THREAD;
+
+    if (!reserveJobs(self, batchSize * PIPELINE_DEPTH, ARCHIVE_BLOCK_SIZE)) {
+        return false;
+    }
+
+    if (mapInput(self, srcFile, &(pipeline.srcMap))) {
+        pipeline.position = (uint64_t)ftello(srcFile);
+        start = pipeline.position;
+    }
+
+    if (!startPipeline(&pipeline, self, dstFile, srcFile, batchSize, encodeReadLoop, encodeWriteLoop)) {
+        unmapFile(&(pipeline.srcMap));
+        return false;
+    }
+
+    startWorkerStats(self);
+
+    while ((batch = (blockBatch*) popRingBuffer(pipeline.filled)) != NULL) {
+        jobs = batch->jobs;
+        numberOfJobs = batch->numberOfJobs;
+        task = (encodeTask){self->workers, jobs};
+
+        if (self->sampleTables && !hasSampledTable) {
+            if (pipeline.srcMap.data) {
+                sampleSymbols(counts, pipeline.srcMap.data + start, pipeline.srcMap.size - start, SAMPLE_CHUNKS);
+            } else {
+                sampledJobs = (numberOfJobs < SAMPLE_STREAM_BLOCKS) ? numberOfJobs : SAMPLE_STREAM_BLOCKS;
+
+                for (i = 0; i < sampledJobs; ++i) {
+                    sampleSymbols(counts, jobs[i].rawData, jobs[i].info.rawSize,
+                                  (SAMPLE_CHUNKS + sampledJobs - 1) / sampledJobs);
+                }
+            }
+
+            buildSampledTable(self, counts, &sampledTable);
+            hasSampledTable = true;
+        }
+
+        if (!self->sampleTables || self->stats.enabled) {
+            if (self->pool) {
+                runThreadPool(self->pool, analyzeBlockTask, &task, numberOfJobs);
+            } else {
+                for (i = 0; i < numberOfJobs; ++i) {
+                    analyzeBlock(self, &(jobs[i]));
+                }
+            }
+        }
+
+        for (i = 0; i < numberOfJobs; ++i) {
+            if (self->sampleTables) {
+                useSampledTable(self, &sampledTable, &(jobs[i]));
+            } else {
+                chooseBlockTable(self, &(jobs[i]));
+            }
+        }
+
+        if (self->pool) {
+            runThreadPool(self->pool, encodeBlockTask, &task, numberOfJobs);
+        } else {
+            for (i = 0; i < numberOfJobs; ++i) {
+                encodeBlock(self, &(jobs[i]));
+            }
+        }
+
+        for (i = 0; i < numberOfJobs; ++i) {
+            if (jobs[i].info.type == BLOCK_HUFFMAN) {
+                self->tableOffset = *archiveOffset;
+            }
+
+            if (!addIndexEntry(self, *archiveOffset, *rawOffset,
+                               (self->tableOffset > 0) ? self->tableOffset : *archiveOffset)) {
+                failPipeline(&pipeline);
+                break;
+            }
+
+            *archiveOffset += sizeof(blockInfo) + jobs[i].packedSize + jobs[i].info.dataSize;
+            *rawOffset += jobs[i].info.rawSize;
+        }
+
+        if (i < numberOfJobs || !pushRingBuffer(pipeline.coded, batch)) {
+            break;
+        }
+    }
+
+    mergeWorkerStats(self);
+    result = stopPipeline(&pipeline);
+
+    /* the mapped source counts as read to its end */
+    if (result && pipeline.srcMap.data) {
+        result = fseeko(srcFile, 0, SEEK_END) == 0;
+    }
+
+    unmapFile(&(pipeline.srcMap));
+
+    return result;
+}
+
+/*
+The stream ends with an empty block header, followed by the seek index
+and the trailer that locates it. Neither file is ever repositioned, so
+both can be pipes.
+*/
+bool compressStream(ARCH* self, FILE* dstFile, FILE* srcFile) {
+    blockInfo endOfStream = {0};
+    uint64_t archiveOffset = sizeof(archiveInfo);
+    uint64_t rawOffset = 0;
+
+    resetArch(self);
+
+    return writeArchiveInfo(self, ARCHIVE_MAGIC, dstFile) &&
+           writeBlocks(self, dstFile, srcFile, &archiveOffset, &rawOffset) &&
+           writeData(self, &endOfStream, sizeof(blockInfo), dstFile) &&
+           writeArchiveIndex(self, archiveOffset + sizeof(blockInfo), rawOffset, dstFile);
+}
+
+/*
+The largest archive compressBuffer() can produce from <srcSize> bytes:
+every block coded at MAX_CODE_LENGTH bits per byte with a full table,
+plus the end marker, the index and the trailer.
+*/
+size_t compressBound(size_t srcSize) {
+    size_t fullBlocks = srcSize / ARCHIVE_BLOCK_SIZE;
+    size_t lastBlock = srcSize % ARCHIVE_BLOCK_SIZE;
+    size_t numberOfBlocks = fullBlocks + (lastBlock > 0);
+    size_t blockOverhead = sizeof(blockInfo) + sizeof(((blockJob*)0)->packedLengths) + sizeof(indexEntry);
+
+    return sizeof(archiveInfo) + sizeof(blockInfo) + sizeof(archiveTrailer) + numberOfBlocks * blockOverhead +
+           (fullBlocks * BLOCK_WORDS((size_t)ARCHIVE_BLOCK_SIZE) + BLOCK_WORDS(lastBlock)) * sizeof(uint32_t);
+}
+
+/*
+This function compresses <srcSize> bytes at <src> into the memory at
+<dst> on the calling thread. Blocks are coded straight from <src>, and
+straight into <dst> whenever the worst case of a block fits there, so the
+data is not copied; the archive is the same one compressStream() writes.
+<dstSize> receives the size of the archive. It fails if <dstCapacity> is
+too small, which never happens with compressBound(<srcSize>) bytes.
+*/
+bool compressBuffer(ARCH* self, void* dst, size_t dstCapacity, size_t* dstSize,
+                    const void* src, size_t srcSize) {
+    uint8_t *out = (uint8_t*) dst;
+    const uint8_t *in = (const uint8_t*) src;
+    blockInfo endOfStream = {0};
+    archiveTrailer trailer;
+    blockJob block;
+    blockJob *job = &block;
+    blockJob sampledTable;
+    uint64_t counts[256] = {0};
+    uint64_t tableOffset = 0;
+    size_t position = sizeof(archiveInfo);
+    size_t rawOffset = 0;
+    size_t indexSize;
+    size_t worstCase;
+
+    resetArch(self);
+
+    if (dstCapacity < sizeof(archiveInfo)) {
+        return false;
+    }
+
+    self->archInfo.magic = ARCHIVE_MAGIC;
+    self->archInfo.blockSize = ARCHIVE_BLOCK_SIZE;
+    memcpy(out, &(self->archInfo), sizeof(archiveInfo));
+
+    if (self->sampleTables) {
+        sampleSymbols(counts, in, srcSize, SAMPLE_CHUNKS);
+        buildSampledTable(self, counts, &sampledTable);
+    }
+
+    for (; rawOffset < srcSize; rawOffset += job->info.rawSize) {
+        job->info = (blockInfo){0};
+        job->info.rawSize = (srcSize - rawOffset < ARCHIVE_BLOCK_SIZE) ? (uint32_t)(srcSize - rawOffset)
+                                                                      : ARCHIVE_BLOCK_SIZE;
+        job->rawData = in + rawOffset;
+
+        if (!self->sampleTables || self->stats.enabled) {
+            analyzeBlock(self, job);
+        }
+
+        if (self->sampleTables) {
+            useSampledTable(self, &sampledTable, job);
+        } else {
+            chooseBlockTable(self, job);
+        }
+
+        if (job->info.type == BLOCK_HUFFMAN) {
+            tableOffset = position;
+        }
+
+        if (dstCapacity - position < sizeof(blockInfo) + job->packedSize ||
+            !addIndexEntry(self, position, rawOffset, (tableOffset > 0) ? tableOffset : position)) {
+            return false;
+        }
+
+        position += sizeof(blockInfo) + job->packedSize;
+        worstCase = (BLOCK_WORDS(job->info.rawSize) + 2) * sizeof(uint32_t);
+
+        if (dstCapacity - position >= worstCase) {
+            encodeBlockData(self, &(job->info), job->encodeTable, job->rawData, out + position);
+        } else {
+            if (!reserveJobs(self, 1, ARCHIVE_BLOCK_SIZE)) {
+                return false;
+            }
+
+            encodeBlockData(self, &(job->info), job->encodeTable, job->rawData, self->jobs[0].encodedBuff);
+
+            if (dstCapacity - position < job->info.dataSize) {
+                return false;
+            }
+
+            memcpy(out + position, self->jobs[0].encodedBuff, job->info.dataSize);
+        }
+
+        memcpy(out + position - job->packedSize - sizeof(blockInfo), &(job->info), sizeof(blockInfo));
+        memcpy(out + position - job->packedSize, job->packedLengths, job->packedSize);
+        position += job->info.dataSize;
+        addProgress(&(self->progress), job->info.rawSize);
+    }
+
+    indexSize = (size_t)self->numberOfBlocks * sizeof(indexEntry);
+
+    if (dstCapacity - position < sizeof(blockInfo) + indexSize + sizeof(archiveTrailer)) {
+        return false;
+    }
+
+    trailer = (archiveTrailer){position + sizeof(blockInfo), rawOffset, self->numberOfBlocks, ARCHIVE_MAGIC};
+
+    memcpy(out + position, &endOfStream, sizeof(blockInfo));
+    position += sizeof(blockInfo);
+
+    if (indexSize > 0) {
+        memcpy(out + position, self->blockIndex, indexSize);
+    }
+
+    position += indexSize;
+    memcpy(out + position, &trailer, sizeof(archiveTrailer));
+
+    *dstSize = position + sizeof(archiveTrailer);
+
+    return true;
+}
+
+/*
+This function reads the size of the data an archive held in memory
+decompresses to from its trailer, so the caller can size the output.
+*/
+bool decompressedSize(const void* src, size_t srcSize, uint64_t* rawSize) {
+    archiveTrailer trailer;
+
+    if (srcSize < sizeof(archiveInfo) + sizeof(blockInfo) + sizeof(archiveTrailer)) {
+        return false;
+    }
+
+    memcpy(&trailer, (const uint8_t*)src + srcSize - sizeof(archiveTrailer), sizeof(archiveTrailer));
+
+    if (trailer.magic != ARCHIVE_MAGIC) {
+        return false;
+    }
+
+    *rawSize = trailer.rawSize;
+
+    return true;
+}
+
+/*
+This function decompresses the archive of <srcSize> bytes at <src> into
+the memory at <dst> on the calling thread. Every block is decoded straight
+from <src> into its place in <dst>. <dstSize> receives the number of bytes
+decoded; it fails on a damaged archive or if <dstCapacity> is too small.
+*/
+bool decompressBuffer(ARCH* self, void* dst, size_t dstCapacity, size_t* dstSize,
+                      const void* src, size_t srcSize) {
+    uint8_t *out = (uint8_t*) dst;
+    const uint8_t *in = (const uint8_t*) src;
+    blockInfo info;
+    uint32_t packedSize;
+    size_t position = sizeof(archiveInfo);
+    size_t rawOffset = 0;
+    bool hasTable = false;
+
+    resetArch(self);
+
+    if (srcSize < sizeof(archiveInfo)) {
+        return false;
+    }
+
+    memcpy(&(self->archInfo), in, sizeof(archiveInfo));
+
+    if (self->archInfo.magic != ARCHIVE_MAGIC || self->archInfo.blockSize == 0 ||
+        self->archInfo.blockSize > ARCHIVE_MAX_BLOCK_SIZE) {
+        return false;
+    }
+
+    while (srcSize - position >= sizeof(blockInfo)) {
+        memcpy(&info, in + position, sizeof(blockInfo));
+        position += sizeof(blockInfo);
+
+        if (info.rawSize == 0) {
+            *dstSize = rawOffset;
+            return true;
+        }
+
+        if (info.type == BLOCK_HUFFMAN && info.firstSymbol <= info.lastSymbol) {
+            packedSize = (info.lastSymbol - info.firstSymbol) / 2 + 1;
+
+            if (srcSize - position < packedSize) {
+                return false;
+            }
+
+            hasTable = rebuildTree(self, &info, in + position);
+            position += packedSize;
+        } else if (info.type == BLOCK_REPEAT || info.type == BLOCK_STORED) {
+            packedSize = 0;
+        } else {
+            return false;
+        }
+
+        if ((!hasTable && info.type != BLOCK_STORED) || info.rawSize > self->archInfo.blockSize ||
+            !hasValidDataSize(&info) || srcSize - position < info.dataSize || dstCapacity - rawOffset < info.rawSize ||
+            !decodeFile(self, &info, in + position, out + rawOffset)) {
+            return false;
+        }
+
+        addProgress(&(self->progress), sizeof(blockInfo) + packedSize + info.dataSize);
+        position += info.dataSize;
+        rawOffset += info.rawSize;
+    }
+
+    return false;
+}
+
+/*
+"-" stands for the standard input or output, which are flushed rather
+than closed when done.
+*/
+static FILE* openFile(const char* fileName, const char* mode) {
+    if (strcmp(fileName, "-") == 0) {
+        return (mode[0] == 'r') ? stdin : stdout;
+    }
+
+    return fopen(fileName, mode);
+}
+
+static bool closeFile(FILE* file) {
+    if (file == NULL) {
+        return true;
+    }
+
+    if (file == stdin || file == stdout) {
+        return fflush(file) == 0;
+    }
+
+    return fclose(file) == 0;
+}
+
+bool compress(ARCH* self, const char* dstFileName, const char* srcFileName) {
+    FILE *srcFile = openFile(srcFileName, "rb");
+    FILE *dstFile = openFile(dstFileName, "wb");
+    bool result = srcFile && dstFile && compressStream(self, dstFile, srcFile);
+
+    closeFile(srcFile);
+
+    return closeFile(dstFile) && result;
+}
+
+/*
+The output is opened for reading as well, which a shared writable mapping
+of it needs.
+*/
+bool decompress(ARCH* self, const char* dstFileName, const char* srcFileName) {
+    FILE *srcFile = openFile(srcFileName, "rb");
+    FILE *dstFile = openFile(dstFileName, "w+b");
+    bool result = srcFile && dstFile && decompressStream(self, dstFile, srcFile);
+
+    closeFile(srcFile);
+
+    return closeFile(dstFile) && result;
+}
+
+/*
+All file I/O of an operation goes through these functions, so the
+statistics see every call and byte.
+*/
+static size_t readData(ARCH* self, void* buff, size_t size, FILE* srcFile) {
+    stageTimer timer;
+    size_t readed;
+
+    startStage(&(self->stats), &timer);
+    readed = fread(buff, sizeof(uint8_t), size, srcFile);
+    stopStage(&(self->stats), STAGE_READ, &timer, readed);
+
+    return readed;
+}
+
+static bool writeData(ARCH* self, const void* buff, size_t size, FILE* dstFile) {
+    stageTimer timer;
+    size_t written;
+
+    startStage(&(self->stats), &timer);
+    written = fwrite(buff, sizeof(uint8_t), size, dstFile);
+    stopStage(&(self->stats), STAGE_WRITE, &timer, written);
+
+    return written == size;
+}
+
+static bool preadAll(ARCH* self, int fd, void* buff, size_t size, uint64_t offset) {
+    stageTimer timer;
+    ssize_t readed;
+
+    while (size > 0) {
+        startStage(&(self->stats), &timer);
+        readed = pread(fd, buff, size, (off_t)offset);
+        stopStage(&(self->stats), STAGE_READ, &timer, (readed > 0) ? (uint64_t)readed : 0);
+
+        if (readed <= 0) {
+            return false;
+        }
+
+        buff = (uint8_t*)buff + readed;
+        size -= (size_t)readed;
+        offset += (uint64_t)readed;
+    }
+
+    return true;
+}
+
+static bool pwriteAll(ARCH* self, int fd, const void* buff, size_t size, uint64_t offset) {
+    stageTimer timer;
+    ssize_t written;
+
+    while (size > 0) {
+        startStage(&(self->stats), &timer);
+        written = pwrite(fd, buff, size, (off_t)offset);
+        stopStage(&(self->stats), STAGE_WRITE, &timer, (written > 0) ? (uint64_t)written : 0);
+
+        if (written <= 0) {
+            return false;
+        }
+
+        buff = (const uint8_t*)buff + written;
+        size -= (size_t)written;
+        offset += (uint64_t)written;
+    }
+
+    return true;
+}
+
+/*
+This function reads <size> bytes at <offset> of an archive, from its
+mapping when <srcMap> has one and with pread() otherwise.
+*/
+static bool readArchiveAt(ARCH* self, const mappedFile* srcMap, int srcFd, void* buff, size_t size,
+                          uint64_t offset) {
+    if (srcMap == NULL || srcMap->data == NULL) {
+        return preadAll(self, srcFd, buff, size, offset);
+    }
+
+    if (offset > srcMap->size || size > srcMap->size - offset) {
+        return false;
+    }
+
+    memcpy(buff, srcMap->data + offset, size);
+
+    return true;
+}
+
+/*
+This function maps all of <srcFile> for reading if it is a regular file
+with data left past its current position. Anything else, such as a pipe
+or an empty file, is left to stdio.
+*/
+static bool mapInput(ARCH* self, FILE* srcFile, mappedFile* map) {
+    stageTimer timer;
+    struct stat status;
+    off_t position = ftello(srcFile);
+    void *data;
+
+    *map = (mappedFile){0};
+
+    if (position < 0 || fstat(fileno(srcFile), &status) != 0 || !S_ISREG(status.st_mode) ||
+        status.st_size <= position || (uint64_t)status.st_size > SIZE_MAX) {
+        return false;
+    }
+
+    startStage(&(self->stats), &timer);
+    data = mmap(NULL, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, fileno(srcFile), 0);
+    stopStage(&(self->stats), STAGE_READ, &timer, (data != MAP_FAILED) ? (uint64_t)status.st_size : 0);
+
+    if (data == MAP_FAILED) {
+        return false;
+    }
+
+    posix_madvise(data, (size_t)status.st_size, POSIX_MADV_SEQUENTIAL);
+    map->data = (uint8_t*) data;
+    map->size = (uint64_t)status.st_size;
+
+    return true;
+}
+
+/*
+This function sizes the regular file <dstFile> to <size> bytes, reserves
+its blocks so a full disk is reported here rather than as a fault while
+decoding, and maps it for writing. The file must be open for reading and
+writing.
+*/
+static bool mapOutput(ARCH* self, FILE* dstFile, uint64_t size, mappedFile* map) {
+    stageTimer timer;
+    struct stat status;
+    int dstFd = fileno(dstFile);
+    void *data;
+
+    *map = (mappedFile){0};
+
+    if (size == 0 || size > SIZE_MAX || fflush(dstFile) != 0 || fstat(dstFd, &status) != 0 ||
+        !S_ISREG(status.st_mode) || ftruncate(dstFd, (off_t)size) != 0 ||
+        posix_fallocate(dstFd, 0, (off_t)size) != 0) {
+        return false;
+    }
+
+    startStage(&(self->stats), &timer);
+    data = mmap(NULL, (size_t)size, PROT_READ | PROT_WRITE, MAP_SHARED, dstFd, 0);
+    stopStage(&(self->stats), STAGE_WRITE, &timer, (data != MAP_FAILED) ? size : 0);
+
+    if (data == MAP_FAILED) {
+        return false;
+    }
+
+    map->data = (uint8_t*) data;
+    map->size = size;
+
+    return true;
+}
+
+static void unmapFile(mappedFile* map) {
+    if (map->data) {
+        munmap(map->data, (size_t)map->size);
+    }
+
+    *map = (mappedFile){0};
+}
+
+/*
+This function loads the table stored by the block at <tableOffset> into
+the decode table of <self>, unless it is the one already loaded.
+*/
+static bool loadBlockTable(ARCH* self, const mappedFile* srcMap, int srcFd, uint64_t tableOffset) {
+    blockInfo info;
+    uint8_t packedLengths[128];
+    uint32_t packedSize;
+
+    if (self->tableOffset == tableOffset) {
+        return true;
+    }
+
+    self->tableOffset = 0;
+
+    if (!readArchiveAt(self, srcMap, srcFd, &info, sizeof(blockInfo), tableOffset) ||
+        info.type != BLOCK_HUFFMAN || info.firstSymbol > info.lastSymbol) {
+        return false;
+    }
+
+    packedSize = (info.lastSymbol - info.firstSymbol) / 2 + 1;
+
+    if (!readArchiveAt(self, srcMap, srcFd, packedLengths, packedSize, tableOffset + sizeof(blockInfo)) ||
+        !rebuildTree(self, &info, packedLengths)) {
+        return false;
+    }
+
+    self->tableOffset = tableOffset;
+
+    return true;
+}
+
+/*
+This function decodes block <job> of the index. The extent of a block in
+the archive and in the output both follow from the next index entry (or
+from the trailer for the last block) and must agree with its header. A
+block that repeats a table finds it through the index as well. Mapped
+blocks are decoded in place, so their extents bound every access.
+*/
+static void decodeBlockTask(void* arg, uint32_t worker, uint32_t job) {
+    decodeTask *task = (decodeTask*) arg;
+    ARCH *self = task->contexts[worker];
+    blockJob *buffers = &(task->buffers[worker]);
+    blockInfo *info = &(buffers->info);
+    indexEntry entry = self->blockIndex[job];
+    uint64_t nextArchiveOffset = task->endOffset;
+    uint64_t nextRawOffset = task->rawSize;
+    uint64_t offset = entry.archiveOffset;
+    const uint8_t *readBuff;
+    uint8_t *writeBuff;
+
+    if (job + 1 < self->numberOfBlocks) {
+        nextArchiveOffset = self->blockIndex[job + 1].archiveOffset;
+        nextRawOffset = self->blockIndex[job + 1].rawOffset;
+    }
+
+    task->results[job] = false;
+
+    if (!readArchiveAt(self, &(task->srcMap), task->srcFd, info, sizeof(blockInfo), offset) ||
+        info->firstSymbol > info->lastSymbol) {
+        return;
+    }
+
+    if (info->type == BLOCK_HUFFMAN && entry.tableOffset == entry.archiveOffset) {
+        buffers->packedSize = (info->lastSymbol - info->firstSymbol) / 2 + 1;
+    } else if ((info->type == BLOCK_REPEAT && entry.tableOffset < entry.archiveOffset) ||
+               info->type == BLOCK_STORED) {
+        buffers->packedSize = 0;
+    } else {
+        return;
+    }
+
+    offset += sizeof(blockInfo) + buffers->packedSize;
+
+    if (info->rawSize == 0 || info->rawSize > self->archInfo.blockSize ||
+        nextRawOffset - entry.rawOffset != info->rawSize || !hasValidDataSize(info) ||
+        nextArchiveOffset - entry.archiveOffset != sizeof(blockInfo) + buffers->packedSize + info->dataSize) {
+        return;
+    }
+
+    readBuff = (task->srcMap.data) ? task->srcMap.data + offset : (const uint8_t*)buffers->encodedBuff;
+    writeBuff = (task->dstMap.data) ? task->dstMap.data + entry.rawOffset : buffers->rawBuff;
+
+    task->results[job] =
+        (info->type == BLOCK_STORED || loadBlockTable(self, &(task->srcMap), task->srcFd, entry.tableOffset)) &&
+        (task->srcMap.data || preadAll(self, task->srcFd, buffers->encodedBuff, info->dataSize, offset)) &&
+        decodeFile(self, info, readBuff, writeBuff) &&
+        (task->dstMap.data || pwriteAll(self, task->dstFd, buffers->rawBuff, info->rawSize, entry.rawOffset));
+
+    addProgress(task->progress, nextArchiveOffset - entry.archiveOffset);
+}
+
+/*
+This function decodes the blocks listed in the index, on a pool of worker
+threads when there is one. The output is sized up front from the size
+the trailer records and every block is written at its own offset, so
+blocks can finish in any order. Regular files are mapped, which lets
+blocks be decoded from the archive straight into the output; otherwise
+they go through the buffers with pread() and pwrite().
+*/
+static bool decompressIndexed(ARCH* self, archiveTrailer* trailer, FILE* dstFile, FILE* srcFile) {
+    uint32_t i;
+    bool result = false;
+
+    bool *results = (bool*) calloc(self->numberOfBlocks + 1, sizeof(bool));
+    decodeTask task = {self->workers, self->jobs, results, trailer->indexOffset - sizeof(blockInfo),
+                       trailer->rawSize, &(self->progress), {0}, {0}, fileno(srcFile), fileno(dstFile)};
+
+    if (results == NULL) {
+        goto finish;
+    }
+
+    startWorkerStats(self);
+
+    for (i = 0; i < self->numberOfWorkers; ++i) {
+        self->workers[i]->tableOffset = 0;
+
+        if (i > 0) {
+            self->workers[i]->archInfo = self->archInfo;
+            self->workers[i]->blockIndex = self->blockIndex;
+            self->workers[i]->numberOfBlocks = self->numberOfBlocks;
+        }
+    }
+
+    if (!mapOutput(self, dstFile, trailer->rawSize, &(task.dstMap)) &&
+        ftruncate(task.dstFd, (off_t)trailer->rawSize) != 0) {
+        goto finish;
+    }
+
+    if (fseeko(srcFile, 0, SEEK_SET) == 0) {
+        mapInput(self, srcFile, &(task.srcMap));
+    }
+
+    if (self->pool) {
+        runThreadPool(self->pool, decodeBlockTask, &task, self->numberOfBlocks);
+    } else {
+        for (i = 0; i < self->numberOfBlocks; ++i) {
+            decodeBlockTask(&task, 0, i);
+        }
+    }
+
+    for (i = 0, result = true; i < self->numberOfBlocks; ++i) {
+        result = result && results[i];
+    }
+
+finish:
+
+    mergeWorkerStats(self);
+
+    for (i = 1; i < self->numberOfWorkers; ++i) {
+        /* the index belongs to <self> */
+        self->workers[i]->blockIndex = NULL;
+        self->workers[i]->numberOfBlocks = 0;
+    }
+
+    unmapFile(&(task.srcMap));
+    unmapFile(&(task.dstMap));
+    free(results);
+
+    return result;
+}
+
+/*
+The reader of a decompression reads whole blocks, header, packed lengths
+and coded words, and checks what it can without a table. It stops at the
+empty block header or after <rawSize> raw bytes, whichever comes first,
+so it never reads past the blocks it was asked for.
+*/
+static void* decodeReadLoop(void* arg) {
+    blockPipeline *pipeline = (blockPipeline*) arg;
+    ARCH *self = pipeline->reader;
+    uint32_t blockSize = pipeline->self->archInfo.blockSize;
+    blockBatch *batch;
+    blockJob *job;
+    blockInfo *info;
+    bool isValid = true;
+    bool atEnd = false;
+
+    while (!atEnd && (batch = (blockBatch*) popRingBuffer(pipeline->empty)) != NULL) {
+        for (batch->numberOfJobs = 0; batch->numberOfJobs < pipeline->batchSize &&
+             pipeline->position < pipeline->rawSize; ++(batch->numberOfJobs)) {
+            job = &(batch->jobs[batch->numberOfJobs]);
+            info = &(job->info);
+
+            if (readData(self, info, sizeof(blockInfo), pipeline->srcFile) != sizeof(blockInfo)) {
+                isValid = false;
+                break;
+            }
+
+            if (info->rawSize == 0) {
+                pipeline->reachedEnd = true;
+                break;
+            }
+
+            if (info->type == BLOCK_HUFFMAN && info->firstSymbol <= info->lastSymbol) {
+                job->packedSize = (info->lastSymbol - info->firstSymbol) / 2 + 1;
+            } else if (info->type == BLOCK_REPEAT || info->type == BLOCK_STORED) {
+                job->packedSize = 0;
+            } else {
+                isValid = false;
+                break;
+            }
+
+            if (info->rawSize > blockSize || info->rawSize > pipeline->rawSize - pipeline->position ||
+                !hasValidDataSize(info) ||
+                readData(self, job->packedLengths, job->packedSize, pipeline->srcFile) != job->packedSize ||
+                readData(self, job->encodedBuff, info->dataSize, pipeline->srcFile) != info->dataSize) {
+                isValid = false;
+                break;
+            }
+
+            pipeline->position += info->rawSize;
+        }
+
+        if (!isValid) {
+            failPipeline(pipeline);
+            break;
+        }
+
+        atEnd = pipeline->reachedEnd || pipeline->position == pipeline->rawSize;
+
+        if (batch->numberOfJobs > 0 && !pushRingBuffer(pipeline->filled, batch)) {
+            break;
+        }
+    }
+
+    closeRingBuffer(pipeline->filled);
+
+    return NULL;
+}
+
+static void* decodeWriteLoop(void* arg) {
+    blockPipeline *pipeline = (blockPipeline*) arg;
+    blockBatch *batch;
+    blockJob *job;
+
+    while ((batch = (blockBatch*) popRingBuffer(pipeline->coded)) != NULL) {
+        for (uint32_t i = 0; i < batch->numberOfJobs && !hasPipelineFailed(pipeline); ++i) {
+            job = &(batch->jobs[i]);
+
+            if (!writeData(pipeline->writer, job->rawBuff, job->info.rawSize, pipeline->dstFile)) {
+                failPipeline(pipeline);
+                break;
+            }
+
+            addProgress(&(pipeline->self->progress), sizeof(blockInfo) + job->packedSize + job->info.dataSize);
+        }
+
+        pushRingBuffer(pipeline->empty, batch);
+    }
+
+    return NULL;
+}
+
+/*
+This function decodes blocks from the current position of <srcFile> until
+<rawSize> bytes are written, or up to the empty block header when
+<rawSize> is UINT64_MAX. <hasTable> tells whether the table of the first
+block is already loaded, in case it repeats one. Blocks are read and
+written by the threads of a pipeline and decoded in order on the calling
+thread, where the tables they store or repeat are rebuilt. Batches hold
+a fixed number of blocks: the block size comes from the archive, so it
+must not decide how many buffers are allocated.
+*/
+static bool readBlocks(ARCH* self, FILE* dstFile, FILE* srcFile, bool hasTable, uint64_t rawSize) {
+    blockPipeline pipeline = {0};
+    blockBatch *batch;
+    blockJob *job;
+    uint32_t batchSize = BATCH_BLOCKS_PER_THREAD;
+    uint32_t i;
+
+    if (!reserveJobs(self, batchSize * PIPELINE_DEPTH, self->archInfo.blockSize)) {
+        return false;
+    }
+
+    pipeline.rawSize = rawSize;
+
+    if (!startPipeline(&pipeline, self, dstFile, srcFile, batchSize, decodeReadLoop, decodeWriteLoop)) {
+        return false;
+    }
+
+    while ((batch = (blockBatch*) popRingBuffer(pipeline.filled)) != NULL) {
+        for (i = 0; i < batch->numberOfJobs; ++i) {
+            job = &(batch->jobs[i]);
+
+            if (job->info.type == BLOCK_HUFFMAN) {
+                hasTable = rebuildTree(self, &(job->info), job->packedLengths);
+            }
+
+            if ((!hasTable && job->info.type != BLOCK_STORED) ||
+                !decodeFile(self, &(job->info), (const uint8_t*)job->encodedBuff, job->rawBuff)) {
+                failPipeline(&pipeline);
+                break;
+            }
+        }
+
+        if (i < batch->numberOfJobs || !pushRingBuffer(pipeline.coded, batch)) {
+            break;
+        }
+    }
+
+    return stopPipeline(&pipeline) && pipeline.reachedEnd == (rawSize == UINT64_MAX);
+}
+
+/*
+The indexed decoder sizes the output and writes every block at its
+offset from the start of the file, so it may only be given a regular
+file that nothing was written to and that does not append. Devices such
+as /dev/null seek but cannot be sized.
+*/
+static bool isOutputAtStart(FILE* dstFile) {
+    struct stat status;
+    int flags = fcntl(fileno(dstFile), F_GETFL);
+
+    return flags >= 0 && (flags & O_APPEND) == 0 && fstat(fileno(dstFile), &status) == 0 &&
+           S_ISREG(status.st_mode) && ftello(dstFile) == 0;
+}
+
+/*
+With a seekable archive that carries an index and a regular output at
+its start, blocks are decoded through the index: in parallel with more
+than one thread, and in place between mappings of regular files.
+Otherwise the stream is decoded from where the archive starts, which
+needs nothing but the blocks themselves and stops at the empty block
+header, so the archive can be a pipe and the output can follow other
+data.
+*/
+bool decompressStream(ARCH* self, FILE* dstFile, FILE* srcFile) {
+    archiveTrailer trailer;
+    off_t start = ftello(srcFile);
+
+    resetArch(self);
+
+    if (!readArchiveInfo(self, ARCHIVE_MAGIC, srcFile)) {
+        return false;
+    }
+
+    if (start >= 0 && isOutputAtStart(dstFile)) {
+        if (readArchiveIndex(self, &trailer, srcFile)) {
+            return reserveWorkers(self) && reserveJobs(self, self->numberOfWorkers, self->archInfo.blockSize) &&
+                   decompressIndexed(self, &trailer, dstFile, srcFile);
+        }
+
+        if (fseeko(srcFile, start + (off_t)sizeof(archiveInfo), SEEK_SET) != 0) {
+            return false;
+        }
+    }
+
+    return readBlocks(self, dstFile, srcFile, false, UINT64_MAX);
+}
+
+/*
+A container packs several files into one archive: the blocks of every
+member follow each other, a member may repeat the table of the one before
+it, and a central directory after the last member lists where each one
+starts and where the table of its first block is. Only the directory is
+held in memory; the sources are read one at a time.
+*/
+bool packFiles(ARCH* self, const char* dstFileName, char* const srcFileNames[], uint32_t numberOfFiles) {
+    FILE *dstFile = openFile(dstFileName, "wb");
+    FILE *srcFile;
+    memberEntry *members = (memberEntry*) calloc(numberOfFiles + 1, sizeof(memberEntry));
+    containerTrailer trailer = {0};
+    uint64_t archiveOffset = sizeof(archiveInfo);
+    uint64_t rawSize;
+    size_t nameLength;
+    uint32_t i;
+    bool result = false;
+
+    resetArch(self);
+
+    if (dstFile == NULL || members == NULL || !writeArchiveInfo(self, CONTAINER_MAGIC, dstFile)) {
+        goto finish;
+    }
+
+    for (i = 0; i < numberOfFiles; ++i) {
+        nameLength = strlen(srcFileNames[i]);
+        srcFile = (nameLength <= MAX_MEMBER_NAME) ? openFile(srcFileNames[i], "rb") : NULL;
+        rawSize = 0;
+
+        /* only the table reference of the first block is needed */
+        self->numberOfBlocks = 0;
+        members[i].archiveOffset = archiveOffset;
+
+        if (srcFile == NULL || !writeBlocks(self, dstFile, srcFile, &archiveOffset, &rawSize)) {
+            closeFile(srcFile);
+            goto finish;
+        }
+
+        closeFile(srcFile);
+
+        members[i].archiveSize = archiveOffset - members[i].archiveOffset;
+        members[i].rawSize = rawSize;
+        members[i].tableOffset = (self->numberOfBlocks > 0) ? self->blockIndex[0].tableOffset : 0;
+        members[i].numberOfBlocks = self->numberOfBlocks;
+        members[i].nameLength = (uint32_t)nameLength;
+    }
+
+    trailer.directoryOffset = archiveOffset;
+    trailer.numberOfMembers = numberOfFiles;
+    trailer.magic = CONTAINER_MAGIC;
+
+    for (i = 0; i < numberOfFiles; ++i) {
+        if (!writeData(self, &(members[i]), sizeof(memberEntry), dstFile) ||
+            !writeData(self, srcFileNames[i], members[i].nameLength, dstFile)) {
+            goto finish;
+        }
+
+        trailer.directorySize += sizeof(memberEntry) + members[i].nameLength;
+    }
+
+    result = writeData(self, &trailer, sizeof(containerTrailer), dstFile);
+
+finish:
+
+    free(members);
+    self->numberOfBlocks = 0;
+
+    return closeFile(dstFile) && result;
+}
+
+/*
+This function loads the central directory of a container through the
+trailer at its end, without reading any member. The caller frees it.
+*/
+static uint8_t* readContainerDirectory(ARCH* self, containerTrailer* trailer, FILE* srcFile) {
+    uint8_t *directory;
+    off_t archiveSize;
+
+    if (!readArchiveInfo(self, CONTAINER_MAGIC, srcFile) ||
+        fseeko(srcFile, 0, SEEK_END) != 0 || (archiveSize = ftello(srcFile)) < (off_t)sizeof(containerTrailer) ||
+        fseeko(srcFile, archiveSize - (off_t)sizeof(containerTrailer), SEEK_SET) != 0 ||
+        readData(self, trailer, sizeof(containerTrailer), srcFile) != sizeof(containerTrailer) ||
+        trailer->magic != CONTAINER_MAGIC ||
+        trailer->directoryOffset < sizeof(archiveInfo) ||
+        trailer->directorySize > (uint64_t)archiveSize - sizeof(containerTrailer) - trailer->directoryOffset ||
+        trailer->directoryOffset + trailer->directorySize + sizeof(containerTrailer) != (uint64_t)archiveSize ||
+        fseeko(srcFile, (off_t)trailer->directoryOffset, SEEK_SET) != 0) {
+        return NULL;
+    }
+
+    directory = (uint8_t*) malloc(trailer->directorySize + 1);
+
+    if (directory != NULL && readData(self, directory, trailer->directorySize, srcFile) != trailer->directorySize) {
+        free(directory);
+        return NULL;
+    }
+
+    return directory;
+}
+
+/*
+This function reads the directory entry at <position> and moves past its
+name. It fails at the end of the directory and on entries that point
+outside the members.
+*/
+static bool nextMember(const uint8_t* directory, const containerTrailer* trailer, uint64_t* position,
+                       memberEntry* member, const char** name) {
+    if (trailer->directorySize - *position < sizeof(memberEntry)) {
+        return false;
+    }
+
+    memcpy(member, directory + *position, sizeof(memberEntry));
+    *position += sizeof(memberEntry);
+    *name = (const char*)(directory + *position);
+
+    if (trailer->directorySize - *position < member->nameLength ||
+        member->archiveOffset < sizeof(archiveInfo) || member->archiveOffset > trailer->directoryOffset ||
+        member->archiveSize > trailer->directoryOffset - member->archiveOffset ||
+        (member->rawSize > 0 && (member->tableOffset < sizeof(archiveInfo) ||
+                                 member->tableOffset > member->archiveOffset))) {
+        return false;
+    }
+
+    *position += member->nameLength;
+
+    return true;
+}
+
+/*
+This function writes one line per member of a container to <dstFile>:
+its size, the size of its blocks in the archive and its name.
+*/
+bool listMembers(ARCH* self, FILE* dstFile, const char* srcFileName) {
+    FILE *srcFile = openFile(srcFileName, "rb");
+    containerTrailer trailer;
+    memberEntry member;
+    const char *name;
+    uint8_t *directory = NULL;
+    uint64_t position = 0;
+    uint32_t i;
+    bool result = false;
+
+    resetArch(self);
+
+    if (srcFile == NULL || (directory = readContainerDirectory(self, &trailer, srcFile)) == NULL) {
+        goto finish;
+    }
+
+    for (i = 0; i < trailer.numberOfMembers; ++i) {
+        if (!nextMember(directory, &trailer, &position, &member, &name) ||
+            fprintf(dstFile, "%12llu %12llu %.*s\n", (unsigned long long)member.rawSize,
+                    (unsigned long long)member.archiveSize, (int)member.nameLength, name) < 0) {
+            goto finish;
+        }
+    }
+
+    result = position == trailer.directorySize;
+
+finish:
+
+    free(directory);
+    closeFile(srcFile);
+
+    return result;
+}
+
+/*
+This function extracts the member named <memberName> from a container.
+It seeks straight to the blocks of the member, loading the table they
+start with from an earlier member if need be, and decodes nothing else.
+Members that start with stored blocks before any table have none to load.
+*/
+bool extractMember(ARCH* self, const char* dstFileName, const char* srcFileName, const char* memberName) {
+    FILE *srcFile = openFile(srcFileName, "rb");
+    FILE *dstFile = NULL;
+    containerTrailer trailer;
+    memberEntry member;
+    const char *name;
+    uint8_t *directory = NULL;
+    uint64_t position = 0;
+    size_t nameLength = strlen(memberName);
+    uint32_t i;
+    bool hasTable;
+    bool result = false;
+
+    resetArch(self);
+
+    if (srcFile == NULL || (directory = readContainerDirectory(self, &trailer, srcFile)) == NULL) {
+        goto finish;
+    }
+
+    for (i = 0; i < trailer.numberOfMembers; ++i) {
+        if (!nextMember(directory, &trailer, &position, &member, &name)) {
+            goto finish;
+        }
+
+        if (member.nameLength == nameLength && memcmp(name, memberName, nameLength) == 0) {
+            break;
+        }
+    }
+
+    if (i == trailer.numberOfMembers || (dstFile = openFile(dstFileName, "wb")) == NULL) {
+        goto finish;
+    }
+
+    hasTable = member.rawSize > 0 && loadBlockTable(self, NULL, fileno(srcFile), member.tableOffset);
+    result = member.rawSize == 0 ||
+             (fseeko(srcFile, (off_t)member.archiveOffset, SEEK_SET) == 0 &&
+              readBlocks(self, dstFile, srcFile, hasTable, member.rawSize) &&
+              ftello(srcFile) == (off_t)(member.archiveOffset + member.archiveSize));
+
+finish:
+
+    free(directory);
+    closeFile(srcFile);
+
+    return closeFile(dstFile) && result;
+}
+
+/*
+This function loads the seek index through the trailer at the end of the
+archive. It fails on anything that is not a complete, consistent index,
+including archives that cannot seek.
+*/
+static bool readArchiveIndex(ARCH* self, archiveTrailer* trailer, FILE* srcFile) {
+    off_t archiveSize;
+    uint32_t numberOfBlocks;
+
+    if (fseeko(srcFile, 0, SEEK_END) != 0 || (archiveSize = ftello(srcFile)) < (off_t)sizeof(archiveTrailer) ||
+        fseeko(srcFile, archiveSize - (off_t)sizeof(archiveTrailer), SEEK_SET) != 0 ||
+        readData(self, trailer, sizeof(archiveTrailer), srcFile) != sizeof(archiveTrailer) ||
+        trailer->magic != ARCHIVE_MAGIC) {
+        return false;
+    }
+
+    numberOfBlocks = trailer->numberOfBlocks;
+
+    if (trailer->indexOffset < sizeof(archiveInfo) + sizeof(blockInfo) ||
+        trailer->indexOffset + (uint64_t)numberOfBlocks * sizeof(indexEntry) + sizeof(archiveTrailer) != (uint64_t)archiveSize ||
+        fseeko(srcFile, (off_t)trailer->indexOffset, SEEK_SET) != 0) {
+        return false;
+    }
+
+    self->numberOfBlocks = 0;
+
+    for (uint32_t i = 0; i < numberOfBlocks; ++i) {
+        indexEntry entry;
+
+        if (readData(self, &entry, sizeof(indexEntry), srcFile) != sizeof(indexEntry) ||
+            (i > 0 && (entry.archiveOffset <= self->blockIndex[i - 1].archiveOffset ||
+                       entry.rawOffset <= self->blockIndex[i - 1].rawOffset)) ||
+            entry.tableOffset < sizeof(archiveInfo) || entry.tableOffset > entry.archiveOffset ||
+            !addIndexEntry(self, entry.archiveOffset, entry.rawOffset, entry.tableOffset)) {
+            return false;
+        }
+    }
+
+    return numberOfBlocks == 0 || (self->blockIndex[0].archiveOffset == sizeof(archiveInfo) &&
+                                   self->blockIndex[0].rawOffset == 0 &&
+                                   self->blockIndex[numberOfBlocks - 1].archiveOffset < trailer->indexOffset - sizeof(blockInfo) &&
+                                   self->blockIndex[numberOfBlocks - 1].rawOffset < trailer->rawSize);
+}
+
+static bool readArchiveInfo(ARCH* self, uint32_t magic, FILE* srcFile) {
+    if (readData(self, &(self->archInfo), sizeof(archiveInfo), srcFile) == sizeof(archiveInfo)) {
+        return self->archInfo.magic == magic && self->archInfo.blockSize > 0 &&
+               self->archInfo.blockSize <= ARCHIVE_MAX_BLOCK_SIZE;
+    } else {
+        return false;
+    }
+}
+
+/*
+A stored block holds exactly its raw bytes; a coded one holds whole words
+and no more of them than the worst code could take.
+*/
+static bool hasValidDataSize(const blockInfo* info) {
+    if (info->type == BLOCK_STORED) {
+        return info->dataSize == info->rawSize;
+    }
+
+    return info->dataSize % sizeof(uint32_t) == 0 && info->dataSize / sizeof(uint32_t) <= BLOCK_WORDS(info->rawSize);
+}
+
+/*
+This function decodes the <rawSize> symbols of the block <info> from its
+<dataSize> bytes at <readBuff>. A stored block is copied. A single stream
+is decoded as it is; for interleaved streams the jump table must account
+for every word of the block. <readBuff> is only read and needs no
+particular alignment.
+*/
+static bool decodeFile(ARCH* self, const blockInfo* info, const uint8_t* readBuff, uint8_t* writeBuff) {
+    bitReader readers[NUMBER_OF_STREAMS];
+    uint8_t *writeBuffs[NUMBER_OF_STREAMS];
+    uint32_t lengths[NUMBER_OF_STREAMS];
+    uint32_t jumpTable[JUMP_WORDS];
+    uint32_t dataWords = info->dataSize / sizeof(uint32_t);
+    uint32_t segment = (info->rawSize + NUMBER_OF_STREAMS - 1) / NUMBER_OF_STREAMS;
+    uint64_t word = JUMP_WORDS;
+    uint32_t start;
+    stageTimer timer;
+    bool result;
+
+    startStage(&(self->stats), &timer);
+
+    if (info->type == BLOCK_STORED) {
+        memcpy(writeBuff, readBuff, info->rawSize);
+        result = true;
+    } else if (info->streams <= 1) {
+        initBitReader(&(readers[0]), readBuff, dataWords);
+        writeBuffs[0] = writeBuff;
+        lengths[0] = info->rawSize;
+        result = self->decodeData(self, readers, writeBuffs, lengths, 1);
+    } else if (info->streams == NUMBER_OF_STREAMS && dataWords >= JUMP_WORDS) {
+        memcpy(jumpTable, readBuff, sizeof(jumpTable));
+
+        for (uint32_t i = 0; i < NUMBER_OF_STREAMS; ++i) {
+            start = (i * segment < info->rawSize) ? i * segment : info->rawSize;
+            lengths[i] = (info->rawSize - start < segment) ? info->rawSize - start : segment;
+            writeBuffs[i] = writeBuff + start;
+
+            if (i < JUMP_WORDS && word + jumpTable[i] > dataWords) {
+                return false;
+            }
+
+            initBitReader(&(readers[i]), readBuff + word * sizeof(uint32_t),
+                          (i < JUMP_WORDS) ? jumpTable[i] : (uint32_t)(dataWords - word));
+            word += (i < JUMP_WORDS) ? jumpTable[i] : 0;
+        }
+
+        result = self->decodeData(self, readers, writeBuffs, lengths, NUMBER_OF_STREAMS);
+    } else {
+        result = false;
+    }
+
+    if (!result) {
+        return false;
+    }
+
+    stopStage(&(self->stats), STAGE_DECODE, &timer, info->rawSize);
+    self->stats.blocks++;
+    self->stats.rawBytes += info->rawSize;
+    self->stats.codedBits += (uint64_t)info->dataSize * 8;
+
+    return true;
+}
+
+/*
+This function turns the code table into a lookup table indexed by the next
+LOOKUP_BITS bits of the stream. No code is longer than LOOKUP_BITS, so
+every code is replicated over each index that starts with it. Entries that
+no code reaches keep an impossible length so the decoder stops on them.
+*/
+static bool buildDecodeTable(ARCH* self, codeInfo codes[]) {
+    uint32_t step, i, j;
+    decodeEntry *table = self->decodeTable;
+
+    if (table == NULL) {
+        table = (decodeEntry*) malloc(LOOKUP_SIZE * sizeof(decodeEntry));
+
+        if (table == NULL) {
+            return false;
+        }
+
+        self->decodeTable = table;
+    }
+
+    for (i = 0; i < LOOKUP_SIZE; ++i) {
+        table[i] = (decodeEntry){0, UINT8_MAX};
+    }
+
+    for (i = 0; i < 256; ++i) {
+        if (codes[i].length == 0) {
+            continue;
+        }
+
+        step = 1u << codes[i].length;
+
+        for (j = codes[i].code; j < LOOKUP_SIZE; j += step) {
+            table[j] = (decodeEntry){codes[i].character, codes[i].length};
+        }
+    }
+
+    return true;
+}
+
+/*
+This function builds the multi-symbol table from the one-symbol table.
+Each entry takes the codes that follow each other from the start of its
+index for as long as they fit in LOOKUP_BITS, up to MULTI_SYMBOLS of
+them. A code that fits is fully determined by the index, so the entry is
+exact. A first code of length L starts 2^(LOOKUP_BITS - L) indices and
+is taken with a chance of about 2^-L, so every index a code can start is
+about as likely as any other, while the rest never occur: an incomplete
+code, such as the one of a block of a single byte value, leaves many of
+them. The mean count over the indices that occur is the number of symbols
+a lookup yields; the decoder only uses the table when that reaches
+MULTI_SYMBOL_THRESHOLD hundredths, since short codes are what make it pay.
+*/
+static bool buildMultiDecodeTable(ARCH* self) {
+    const decodeEntry *table = self->decodeTable;
+    multiDecodeEntry *multiTable = self->multiDecodeTable;
+    multiDecodeEntry *multiEntry;
+    decodeEntry entry;
+    uint64_t symbols = 0;
+    uint64_t reachable = 0;
+    uint32_t i;
+
+    if (multiTable == NULL) {
+        multiTable = (multiDecodeEntry*) malloc(LOOKUP_SIZE * sizeof(multiDecodeEntry));
+
+        if (multiTable == NULL) {
+            return false;
+        }
+
+        self->multiDecodeTable = multiTable;
+    }
+
+    for (i = 0; i < LOOKUP_SIZE; ++i) {
+        multiEntry = &(multiTable[i]);
+        *multiEntry = (multiDecodeEntry){{0}, 0, table[i].length};
+
+        if (table[i].length > LOOKUP_BITS) {
+            continue;
+        }
+
+        multiEntry->symbols[0] = table[i].symb;
+        multiEntry->count = 1;
+
+        while (multiEntry->count < MULTI_SYMBOLS) {
+            entry = table[(i >> multiEntry->length) & LOOKUP_MASK];
+
+            if (entry.length > LOOKUP_BITS - multiEntry->length) {
+                break;
+            }
+
+            multiEntry->symbols[multiEntry->count++] = entry.symb;
+            multiEntry->length += entry.length;
+        }
+
+        symbols += multiEntry->count;
+        reachable++;
+    }
+
+    self->useMultiDecode = reachable > 0 && symbols * 100 >= (uint64_t)MULTI_SYMBOL_THRESHOLD * reachable;
+
+    return true;
+}
+
+static bool rebuildTree(ARCH* self, blockInfo* info, const uint8_t packedLengths[]) {
+    uint32_t firstSymbol = info->firstSymbol;
+    uint32_t lastSymbol = info->lastSymbol;
+    codeInfo *codes = self->codes;
+    stageTimer timer;
+    bool result;
+
+    if (firstSymbol > lastSymbol) {
+        return false;
+    }
+
+    startStage(&(self->stats), &timer);
+
+    for (uint32_t i = 0; i < 256; ++i) {
+        if (i >= firstSymbol && i <= lastSymbol) {
+            codes[i].length = (packedLengths[(i - firstSymbol) / 2] >> (((i - firstSymbol) & 1) * 4)) & 0x0F;
+        } else {
+            codes[i].length = 0;
+        }
+    }
+
+    result = assignCanonicalCodes(codes) && buildDecodeTable(self, codes) && buildMultiDecodeTable(self);
+    stopStage(&(self->stats), STAGE_DECODE_TABLE, &timer, 0);
+
+    return result;
+}
+
+/*
+This function drops the tree of the previous block by emptying the node
+arena and clears everything derived from it, so the next block starts
+from scratch.
+*/
+static void resetTree(ARCH* self) {
+    self->numberOfNodes = 0;
+    self->numberOfLeaves = 0;
+    self->root = NO_NODE;
+    memset(self->codes, 0, sizeof(self->codes));
+}
+
+/*
+Nodes are taken from the arena of the context in order. A block has at
+most 256 leaves, so a tree never needs more than TREE_ARENA_SIZE nodes.
+*/
+static uint16_t initQTreeNode(ARCH* self) {
+    qtreeNode *newElement = &(self->nodes[self->numberOfNodes]);
+
+    newElement->rchild = NO_NODE;
+    newElement->lchild = NO_NODE;
+    newElement->weight = 0;
+    newElement->symb = 0;
+    newElement->isLeaf = false;
+
+    return self->numberOfNodes++;
+}
+
+/*
+This function creates the worker contexts and the pool for the current
+<numberOfThreads> of <self> and keeps them for later operations. The
+first worker is <self> itself; with a single thread there is no pool.
+Every worker holds its own batches of blocks, so their number is capped
+at MAX_THREADS.
+*/
+static bool reserveWorkers(ARCH* self) {
+    uint32_t numberOfThreads = (self->numberOfThreads > 0) ? self->numberOfThreads : 1;
+
+    numberOfThreads = (numberOfThreads < MAX_THREADS) ? numberOfThreads : MAX_THREADS;
+
+    if (self->numberOfWorkers == numberOfThreads) {
+        return true;
+    }
+
+    releaseWorkers(self);
+
+    self->workers = (ARCH**) calloc(numberOfThreads, sizeof(ARCH*));
+
+    if (self->workers == NULL) {
+        return false;
+    }
+
+    self->workers[0] = self;
+    self->numberOfWorkers = numberOfThreads;
+
+    for (uint32_t i = 1; i < numberOfThreads; ++i) {
+        if ((self->workers[i] = initArch()) == NULL) {
+            releaseWorkers(self);
+            return false;
+        }
+    }
+
+    if (numberOfThreads > 1 && (self->pool = initThreadPool(numberOfThreads)) == NULL) {
+        releaseWorkers(self);
+        return false;
+    }
+
+    return true;
+}
+
+static void releaseWorkers(ARCH* self) {
+    freeThreadPool(self->pool);
+    self->pool = NULL;
+
+    for (uint32_t i = 1; self->workers && i < self->numberOfWorkers; ++i) {
+        freeArch(self->workers[i]);
+    }
+
+    free(self->workers);
+    self->workers = NULL;
+    self->numberOfWorkers = 0;
+}
+
+/*
+Workers collect statistics in their own contexts while <self> has them
+on, and hand them over to <self> when a parallel run is done.
+*/
+static void startWorkerStats(ARCH* self) {
+    for (uint32_t i = 1; i < self->numberOfWorkers; ++i) {
+        self->workers[i]->stats.enabled = self->stats.enabled;
+        resetStats(&(self->workers[i]->stats));
+    }
+}
+
+static void mergeWorkerStats(ARCH* self) {
+    for (uint32_t i = 1; i < self->numberOfWorkers; ++i) {
+        mergeStats(&(self->stats), &(self->workers[i]->stats));
+        resetStats(&(self->workers[i]->stats));
+    }
+}
+
+/*
+This function makes sure <self> owns at least <numberOfJobs> block
+buffers for blocks of up to <blockSize> bytes. They are kept for later
+operations and only replaced when a larger set is needed.
+*/
+static bool reserveJobs(ARCH* self, uint32_t numberOfJobs, uint32_t blockSize) {
+    if (numberOfJobs <= self->numberOfJobs && blockSize <= self->jobBlockSize) {
+        return true;
+    }
+
+    releaseJobs(self);
+
+    self->jobs = (blockJob*) calloc(numberOfJobs, sizeof(blockJob));
+
+    if (self->jobs == NULL) {
+        return false;
+    }
+
+    self->numberOfJobs = numberOfJobs;
+
+    for (uint32_t i = 0; i < numberOfJobs; ++i) {
+        self->jobs[i].rawBuff = (uint8_t*) malloc(blockSize);
+        self->jobs[i].encodedBuff = (uint32_t*) malloc((BLOCK_WORDS(blockSize) + 2) * sizeof(uint32_t));
+
+        if (self->jobs[i].rawBuff == NULL || self->jobs[i].encodedBuff == NULL) {
+            releaseJobs(self);
+            return false;
+        }
+    }
+
+    self->jobBlockSize = blockSize;
+
+    return true;
+}
+
+static void releaseJobs(ARCH* self) {
+    for (uint32_t i = 0; self->jobs && i < self->numberOfJobs; ++i) {
+        free(self->jobs[i].rawBuff);
+        free(self->jobs[i].encodedBuff);
+    }
+
+    free(self->jobs);
+    self->jobs = NULL;
+    self->numberOfJobs = 0;
+    self->jobBlockSize = 0;
+}
+
+ARCH* initArch(void) {
+    ARCH *self = (ARCH*) calloc(1, sizeof(ARCH));
+
+    if (self == NULL) {
+        return NULL;
+    }
+
+    self->root = NO_NODE;
+    self->numberOfThreads = 1;
+    self->encodeData = selectEncodeKernel();
+    self->decodeData = selectDecodeKernel();
+
+    return self;
+}
+
+/*
+This function forgets everything a previous operation left in <self> but
+keeps its allocations and settings, so the context can be used again
+right away. Every operation starts with it.
+*/
+void resetArch(ARCH* self) {
+    resetTree(self);
+    memset(self->frequencies, 0, sizeof(self->frequencies));
+    memset(&(self->archInfo), 0, sizeof(archiveInfo));
+    self->currentTable.isValid = false;
+    self->tableOffset = 0;
+    self->numberOfBlocks = 0;
+    resetStats(&(self->stats));
+    __atomic_store_n(&(self->progress), 0, __ATOMIC_RELAXED);
+}
+
+void freeArch(ARCH* self) {
+    if (self == NULL) {
+        return;
+    }
+
+    releaseWorkers(self);
+    releaseJobs(self);
+    free(self->decodeTable);
+    free(self->multiDecodeTable);
+    free(self->blockIndex);
+    free(self);
+}
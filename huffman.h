@@ -8,18 +8,78 @@
 #include <string.h> 
 #include <math.h>
 
-#define BUFFER_SIZE 8192
+#include "stats.h"
+#include "encode_kernel.h"
+#include "bit_stream.h"
+
 #define BITS_IN_BLOCK 32
+#define ARCHIVE_MAGIC 0x46465548
+#define CONTAINER_MAGIC 0x43465548
+#define MAX_MEMBER_NAME 4096
+#define ARCHIVE_BLOCK_SIZE (1u << 17)
+#define ARCHIVE_MAX_BLOCK_SIZE (1u << 26)
+#define MAX_CODE_LENGTH 11
+#define LOOKUP_BITS MAX_CODE_LENGTH
+#define LOOKUP_SIZE (1u << LOOKUP_BITS)
+#define LOOKUP_MASK (LOOKUP_SIZE - 1)
+#define TREE_ARENA_SIZE 512
+#define NO_NODE UINT16_MAX
+#define CODES_PER_FLUSH 4
+#define MULTI_SYMBOLS 4
+#define MULTI_SYMBOL_THRESHOLD 150
+#define BATCH_BLOCKS_PER_THREAD 8
+#define MAX_THREADS 64
+#define SAMPLE_STREAM_BLOCKS BATCH_BLOCKS_PER_THREAD
+#define PIPELINE_DEPTH 3
+#define BLOCK_HUFFMAN 0
+#define BLOCK_REPEAT 1
+#define BLOCK_STORED 2
+#define NUMBER_OF_STREAMS 4
+#define JUMP_WORDS (NUMBER_OF_STREAMS - 1)
+#define INTERLEAVE_MIN_SIZE (1u << 14)
+#define ENCODED_WORDS(length) (((uint64_t)(length) * MAX_CODE_LENGTH + BITS_IN_BLOCK - 1) / BITS_IN_BLOCK)
+#define BLOCK_WORDS(length) (ENCODED_WORDS(length) + 2 * NUMBER_OF_STREAMS)
 
 typedef struct qtreeNode qtreeNode;
 typedef struct ARCH ARCH;
 typedef struct codeInfo codeInfo;
 typedef struct archiveInfo archiveInfo;
+typedef struct blockInfo blockInfo;
+typedef struct blockJob blockJob;
+typedef struct indexEntry indexEntry;
+typedef struct archiveTrailer archiveTrailer;
+typedef struct activeTable activeTable;
+typedef struct memberEntry memberEntry;
+typedef struct containerTrailer containerTrailer;
+typedef struct decodeEntry decodeEntry;
+typedef struct multiDecodeEntry multiDecodeEntry;
+typedef struct symbolWeight symbolWeight;
+typedef struct mappedFile mappedFile;
 
 struct archiveInfo {
-    uint8_t tableLength;
-    uint32_t numberOfBlocks;
-    uint32_t remainingBits;
+    uint32_t magic;
+    uint32_t blockSize;
+};
+
+/*
+Every block of the archive starts with this header, followed by its
+packed code lengths and <dataSize> bytes of coded data. A BLOCK_REPEAT
+block stores no lengths and is coded with the table of the last block
+that stored one. A BLOCK_STORED block holds its <rawSize> bytes as they
+are, with no lengths, and leaves the table in effect as it was.
+Otherwise the data is one bitstream when <streams> is 0 or 1. With
+NUMBER_OF_STREAMS, each stream codes a contiguous quarter of the
+block and a jump table of JUMP_WORDS words in front of them gives the
+number of words of all but the last one. A header with <rawSize> of zero
+ends the stream.
+*/
+struct blockInfo {
+    uint32_t rawSize;
+    uint32_t dataSize;
+    uint8_t firstSymbol;
+    uint8_t lastSymbol;
+    uint8_t type;
+    uint8_t streams;
 };
 
 struct codeInfo {
@@ -28,27 +88,189 @@ struct codeInfo {
 	uint32_t code;
 };
 
+/*
+The seek index has one entry per block: where its header starts in the
+archive, where its decoded bytes start in the output and where the block
+that stores its code table starts. A stored block ahead of any table
+points at itself.
+*/
+struct indexEntry {
+    uint64_t archiveOffset;
+    uint64_t rawOffset;
+    uint64_t tableOffset;
+};
+
+/*
+The last bytes of an archive: where the index starts, how many entries
+it has and the size of the decoded data.
+*/
+struct archiveTrailer {
+    uint64_t indexOffset;
+    uint64_t rawSize;
+    uint32_t numberOfBlocks;
+    uint32_t magic;
+};
+
+/*
+The central directory of a container has one entry per member, followed
+by its <nameLength> bytes of name: where the blocks of the member start
+and how many bytes they take, its decoded size and where the block that
+stores the table of its first block starts.
+*/
+struct memberEntry {
+    uint64_t archiveOffset;
+    uint64_t archiveSize;
+    uint64_t rawSize;
+    uint64_t tableOffset;
+    uint32_t numberOfBlocks;
+    uint32_t nameLength;
+};
+
+/*
+The last bytes of a container locate its central directory.
+*/
+struct containerTrailer {
+    uint64_t directoryOffset;
+    uint64_t directorySize;
+    uint32_t numberOfMembers;
+    uint32_t magic;
+};
+
+/*
+One block on its way through the coder: the raw bytes as read, and the
+header, packed code lengths and coded words that will be written for it.
+<rawData> is where the raw bytes are coded from, either <rawBuff> or the
+mapped source.
+*/
+struct blockJob {
+    blockInfo info;
+    uint8_t packedLengths[128];
+    uint32_t packedSize;
+    uint32_t frequencies[256];
+    uint8_t codeLengths[256];
+    uint16_t encodeTable[256];
+    const uint8_t *rawData;
+    uint8_t *rawBuff;
+    uint32_t *encodedBuff;
+};
+
+/*
+The code table that BLOCK_REPEAT blocks refer to while compressing.
+*/
+struct activeTable {
+    uint8_t codeLengths[256];
+    uint16_t encodeTable[256];
+    bool isValid;
+};
+
+struct decodeEntry {
+    uint8_t symb;
+    uint8_t length;
+};
+
+/*
+An entry of the multi-symbol decode table: the <count> symbols whose
+codes, <length> bits in all, start the index of the entry.
+*/
+struct multiDecodeEntry {
+    uint8_t symbols[MULTI_SYMBOLS];
+    uint8_t count;
+    uint8_t length;
+};
+
+/*
+A decode kernel decodes <lengths> symbols of each of <streams> streams
+with the tables of <self>, a single stream or NUMBER_OF_STREAMS
+interleaved ones, and fails on a corrupt stream.
+*/
+typedef bool (*decodeKernel)(const ARCH* self, const bitReader readers[], uint8_t* writeBuffs[],
+                             const uint32_t lengths[], uint32_t streams);
+
+struct symbolWeight {
+    uint32_t weight;
+    uint8_t symb;
+};
+
+/*
+A whole file mapped into memory; <data> is NULL when it is not mapped.
+*/
+struct mappedFile {
+    uint8_t *data;
+    uint64_t size;
+};
+
+/*
+Tree nodes live in the <nodes> arena of their context and refer to their
+children by index; NO_NODE marks a missing child.
+*/
 struct qtreeNode {
-    qtreeNode *rchild;
-    qtreeNode *lchild;
-    qtreeNode *nextNode;
     uint32_t weight;
+    uint16_t rchild;
+    uint16_t lchild;
     uint8_t symb;
+    bool isLeaf;
 };
 
+/*
+A context holds everything an operation needs, so contexts are
+independent of each other and one can be used per thread. It is created
+by initArch(), reused for any number of operations, each of which starts
+with resetArch(), and destroyed by freeArch(). The worker contexts, the
+pool and the block buffers are kept between operations. <progress> counts
+the input bytes the current operation has consumed and may be read
+atomically from any thread. <encodeData> and <decodeData> are the
+kernels picked for the processor when the context is created. Setting
+<sampleTables> makes compression code every block with one table built
+from a sample of the source instead of counting each block.
+*/
 struct ARCH {
-    qtreeNode *head;
-    qtreeNode *tail;
-    qtreeNode *root;
-    uint8_t *progress;
+    qtreeNode nodes[TREE_ARENA_SIZE];
+    uint16_t leaves[256];
+    uint16_t root;
+    uint16_t numberOfNodes;
+    uint64_t progress;
     codeInfo codes[256];
+    uint16_t encodeTable[256];
+    uint64_t frequencies[256];
+    decodeEntry *decodeTable;
+    multiDecodeEntry *multiDecodeTable;
+    bool useMultiDecode;
     archiveInfo archInfo;
-    uint8_t numberOfCodes;   
+    activeTable currentTable;
+    uint64_t tableOffset;
+    indexEntry *blockIndex;
+    uint32_t numberOfBlocks;
+    uint32_t indexCapacity;
+    uint16_t numberOfLeaves;
+    uint32_t numberOfThreads;
+    bool sampleTables;
+    struct threadPool *pool;
+    ARCH **workers;
+    uint32_t numberOfWorkers;
+    blockJob *jobs;
+    uint32_t numberOfJobs;
+    uint32_t jobBlockSize;
+    encodeKernel encodeData;
+    decodeKernel decodeData;
+    codecStats stats;
 };
 
 
 bool compress(ARCH* self, const char* dstFileName, const char* srcFileName);
 bool decompress(ARCH* self, const char* dstFileName, const char* srcFileName);
+bool compressStream(ARCH* self, FILE* dstFile, FILE* srcFile);
+bool decompressStream(ARCH* self, FILE* dstFile, FILE* srcFile);
+size_t compressBound(size_t srcSize);
+bool compressBuffer(ARCH* self, void* dst, size_t dstCapacity, size_t* dstSize,
+                    const void* src, size_t srcSize);
+bool decompressedSize(const void* src, size_t srcSize, uint64_t* rawSize);
+bool decompressBuffer(ARCH* self, void* dst, size_t dstCapacity, size_t* dstSize,
+                      const void* src, size_t srcSize);
+bool packFiles(ARCH* self, const char* dstFileName, char* const srcFileNames[], uint32_t numberOfFiles);
+bool listMembers(ARCH* self, FILE* dstFile, const char* srcFileName);
+bool extractMember(ARCH* self, const char* dstFileName, const char* srcFileName, const char* memberName);
 ARCH* initArch(void);
+void resetArch(ARCH* self);
+void freeArch(ARCH* self);
 
 #endif
@@ -5,40 +5,164 @@
 #include <pthread.h>
 #include <unistd.h>
 #include <getopt.h>
-#include <time.h>
+#include <sys/stat.h>
 
 #include "huffman.h"
 #include "prog_bar.h"
 
-pthread_t tid;
+static uint64_t fileSize(const char*);
+
+/*
+The size of a regular file, or zero when it is unknown.
+*/
+static uint64_t fileSize(const char* fileName) {
+    struct stat info;
+
+    if (strcmp(fileName, "-") == 0 || stat(fileName, &info) != 0 || !S_ISREG(info.st_mode)) {
+        return 0;
+    }
+
+    return (uint64_t)info.st_size;
+}
+
+static void usage(const char* name) {
+    fprintf(stderr, "usage: %s [--stats] [--progress] [--sample] [-j threads] -c archive source\n"
+                    "       %s [--stats] [--progress] [-j threads] -x output archive [member]\n"
+                    "       %s [--stats] [--progress] [--sample] [-j threads] -a archive file...\n"
+                    "       %s [--stats] -l archive\n"
+                    "Use - for the standard input or output. -j takes 1 to %d threads.\n"
+                    "--stats prints a JSON report of the time, I/O and memory of each\n"
+                    "stage to the standard error.\n"
+                    "--progress reports progress on the standard error: a bar on a terminal,\n"
+                    "JSON lines otherwise. --sample codes every block with one table built\n"
+                    "from a sample of the source instead of counting each block.\n",
+            name, name, name, name, MAX_THREADS);
+}
 
 int main(int argc, char **argv) {
     extern char* optarg;
-    clock_t t1, t2;
+    extern int optind;
+    static const struct option longOptions[] = {
+        {"stats", no_argument, NULL, 's'},
+        {"progress", no_argument, NULL, 'p'},
+        {"sample", no_argument, NULL, 'S'},
+        {NULL, 0, NULL, 0}
+    };
+    stageTimer timer;
+    progressReporter *reporter = NULL;
+    bool showProgress = false;
+    uint64_t total = 0;
+    const char *operation;
+    char *dstFileName = NULL;
+    int mode = 0;
+    long threads;
     int c;
+    bool result;
 
-	//pthread_create(&(tid), NULL, &show_bar, NULL);
     ARCH* arch = initArch();
 
-    while ((c = getopt(argc, argv, "c:x:")) != -1) {
+    if (arch == NULL) {
+        return 1;
+    }
+
+    while ((c = getopt_long(argc, argv, "c:x:a:lj:", longOptions, NULL)) != -1) {
         switch (c) {
-            case 'c':
-                t1 = clock();
-                compress(arch, optarg, argv[1]);
-                t2 = clock();
-                printf("Encoding completed in %.5f sec\n", ((double)t2 - (double)t1) / CLOCKS_PER_SEC);
+            case 's':
+                arch->stats.enabled = true;
+                break;
+            case 'p':
+                showProgress = true;
+                break;
+            case 'S':
+                arch->sampleTables = true;
                 break;
+            case 'c':
             case 'x':
-                t1 = clock();
-                decompress(arch, optarg, argv[1]);
-                t2 = clock();
-                printf("Decoding completed in %.5f sec\n", ((double)t2 - (double)t1) / CLOCKS_PER_SEC); 
+            case 'a':
+                mode = c;
+                dstFileName = optarg;
+                break;
+            case 'l':
+                mode = c;
+                break;
+            case 'j':
+                threads = strtol(optarg, NULL, 10);
+
+                if (threads < 1 || threads > MAX_THREADS) {
+                    usage(argv[0]);
+                    freeArch(arch);
+                    return 1;
+                }
+
+                arch->numberOfThreads = (uint32_t)threads;
                 break;
             default:
-                abort();
+                usage(argv[0]);
+                freeArch(arch);
+                return 1;
         } 
+    }
+
+    if (mode == 0 || optind >= argc) {
+        usage(argv[0]);
+        freeArch(arch);
+        return 1;
+    }
 
+    if (showProgress && mode != 'l') {
+        /* progress counts the input consumed, which is only known for whole files */
+        if (mode == 'a') {
+            for (int i = optind; i < argc; ++i) {
+                total += fileSize(argv[i]);
+            }
+        } else if (mode == 'c' || optind + 1 >= argc) {
+            total = fileSize(argv[optind]);
+        }
+
+        reporter = startProgress(&(arch->progress), total, stderr);
     }
 
-    return 0;
+    startTimer(&timer);
+
+    switch (mode) {
+        case 'c':
+            operation = "compress";
+            result = compress(arch, dstFileName, argv[optind]);
+            break;
+        case 'a':
+            operation = "pack";
+            result = packFiles(arch, dstFileName, argv + optind, (uint32_t)(argc - optind));
+            break;
+        case 'l':
+            operation = "list";
+            result = listMembers(arch, stdout, argv[optind]);
+            break;
+        default:
+            if (optind + 1 < argc) {
+                operation = "extract";
+                result = extractMember(arch, dstFileName, argv[optind], argv[optind + 1]);
+            } else {
+                operation = "decompress";
+                result = decompress(arch, dstFileName, argv[optind]);
+            }
+
+            break;
+    }
+
+    if (result && total > 0) {
+        completeProgress(&(arch->progress), total);
+    }
+
+    stopProgress(reporter);
+
+    if (arch->stats.enabled) {
+        printStats(&(arch->stats), operation, arch->numberOfThreads, &timer, stderr);
+    } else if (result && mode != 'l') {
+        fprintf(stderr, "%s completed in %.5f sec\n", (mode == 'x') ? "Decoding" : "Encoding",
+                elapsedSeconds(&timer));
+    }
+
+    freeArch(arch);
+
+    return result ? 0 : 1;
 }
@@ -1,33 +1,132 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
 #include "prog_bar.h"
 
-/*float progress = 0.0;
+static double wallTime(void);
+static void printProgress(progressReporter*, bool);
+static void* reportLoop(void*);
+
+static double wallTime(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+static void printProgress(progressReporter* self, bool isFinal) {
+    uint64_t done = __atomic_load_n(self->counter, __ATOMIC_RELAXED);
+    double elapsed = wallTime() - self->startTime;
+    double rate = (elapsed > 0.0) ? done / elapsed : 0.0;
+    double fraction = (self->total > 0) ? (double)done / (double)self->total : 0.0;
+    double eta = (rate > 0.0 && self->total > done) ? (self->total - done) / rate : 0.0;
+    int filled, i;
+
+    fraction = (fraction > 1.0) ? 1.0 : fraction;
+
+    if (!self->isTerminal) {
+        fprintf(self->output, "{\"progress\":{\"bytes\":%llu,\"total\":%llu,\"elapsed_seconds\":%.3f,"
+                              "\"mbps\":%.2f,\"eta_seconds\":%.1f,\"done\":%s}}\n",
+                (unsigned long long)done, (unsigned long long)self->total, elapsed, rate / 1e6, eta,
+                isFinal ? "true" : "false");
+    } else if (self->total > 0) {
+        filled = (int)(fraction * PROGRESS_BAR_WIDTH);
+        fputs("\r[", self->output);
+
+        for (i = 0; i < PROGRESS_BAR_WIDTH; ++i) {
+            fputc((i < filled) ? '=' : (i == filled) ? '>' : ' ', self->output);
+        }
+
+        fprintf(self->output, "] %3d%%  %8.1f MB/s  ETA %3d:%02d ", (int)(fraction * 100.0), rate / 1e6,
+                (int)eta / 60, (int)eta % 60);
+    } else {
+        fprintf(self->output, "\r%12.1f MB  %8.1f MB/s ", done / 1e6, rate / 1e6);
+    }
+
+    if (isFinal && self->isTerminal) {
+        fputc('\n', self->output);
+    }
+
+    fflush(self->output);
+}
+
+static void* reportLoop(void* arg) {
+    progressReporter *self = (progressReporter*) arg;
+    long interval = self->isTerminal ? PROGRESS_TTY_INTERVAL_MS : PROGRESS_LOG_INTERVAL_MS;
+    struct timespec deadline;
+
+    pthread_mutex_lock(&(self->lock));
+
+    while (!self->stop) {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += (interval % 1000) * 1000000;
+        deadline.tv_sec += interval / 1000 + deadline.tv_nsec / 1000000000;
+        deadline.tv_nsec %= 1000000000;
+
+        pthread_cond_timedwait(&(self->wake), &(self->lock), &deadline);
+
+        if (!self->stop) {
+            printProgress(self, false);
+        }
+    }
+
+    pthread_mutex_unlock(&(self->lock));
+
+    return NULL;
+}
+
+/*
+This function starts reporting the bytes published to <counter> against
+<total> on <output>. It returns NULL if the thread cannot be started, in
+which case the job simply runs without a report.
+*/
+progressReporter* startProgress(const uint64_t* counter, uint64_t total, FILE* output) {
+    progressReporter *self = (progressReporter*) calloc(1, sizeof(progressReporter));
+
+    if (self == NULL) {
+        return NULL;
+    }
+
+    self->counter = counter;
+    self->total = total;
+    self->output = output;
+    self->isTerminal = isatty(fileno(output));
+    self->startTime = wallTime();
 
-void* show_bar(void* progress) {
-	while (*progress < 1.0) {
-	    int barWidth = 70;
+    pthread_mutex_init(&(self->lock), NULL);
+    pthread_cond_init(&(self->wake), NULL);
 
-	    printf("[");
-	    int pos = barWidth * (*progress);
+    if (pthread_create(&(self->thread), NULL, reportLoop, self) != 0) {
+        pthread_cond_destroy(&(self->wake));
+        pthread_mutex_destroy(&(self->lock));
+        free(self);
+        return NULL;
+    }
 
-	    for (int i = 0; i < barWidth; ++i) {
-	        if (i < pos) {
-	        	printf("=");
-	        } else {
-	        	if (i == pos) {
-	        		printf(">");
-	        	} else {
-	        		printf(" ");
-	        	}
-	        }
-	    }
+    return self;
+}
 
-	    printf("] %d  \r", (int)((*progress) * 100.0));
-	    fflush(stdin);
+/*
+This function stops the reporter, prints the final state and frees it.
+*/
+void stopProgress(progressReporter* self) {
+    if (self == NULL) {
+        return;
+    }
 
-	    //progress += 0.16; // for demonstration only
-	}
+    pthread_mutex_lock(&(self->lock));
+    self->stop = true;
+    pthread_cond_signal(&(self->wake));
+    pthread_mutex_unlock(&(self->lock));
 
-	printf("\n");
+    pthread_join(self->thread, NULL);
+    printProgress(self, true);
 
-	return NULL;
-}*/
\ No newline at end of file
+    pthread_cond_destroy(&(self->wake));
+    pthread_mutex_destroy(&(self->lock));
+    free(self);
+}
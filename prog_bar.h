@@ -2,7 +2,52 @@
 #define PROG_BAR_H
 
 #include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
 
-void* show_bar(void*);
+#define PROGRESS_TTY_INTERVAL_MS 200
+#define PROGRESS_LOG_INTERVAL_MS 1000
+#define PROGRESS_BAR_WIDTH 30
 
-#endif
\ No newline at end of file
+typedef struct progressReporter progressReporter;
+
+/*
+The reporter thread samples <counter> on its own schedule: on a terminal
+it redraws a bar with the percentage, the throughput and the time left,
+otherwise it prints a line of JSON at a slower pace. A <total> of zero
+means the size is unknown, so only bytes and throughput are shown.
+*/
+struct progressReporter {
+    const uint64_t *counter;
+    uint64_t total;
+    FILE *output;
+    bool isTerminal;
+    bool stop;
+    double startTime;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+};
+
+/*
+Producers publish progress once per buffer with a relaxed atomic add, so
+the coding loops pay nothing when nobody is watching.
+*/
+static inline void addProgress(uint64_t* counter, uint64_t bytes) {
+    __atomic_fetch_add(counter, bytes, __ATOMIC_RELAXED);
+}
+
+/*
+Producers count the blocks they code or decode, which leaves out the
+archive header, index and trailer; once an operation has succeeded, all
+<total> bytes of its input were consumed.
+*/
+static inline void completeProgress(uint64_t* counter, uint64_t total) {
+    __atomic_store_n(counter, total, __ATOMIC_RELAXED);
+}
+
+progressReporter* startProgress(const uint64_t* counter, uint64_t total, FILE* output);
+void stopProgress(progressReporter* self);
+
+#endif
@@ -0,0 +1,95 @@
+#include "ring_buffer.h"
+
+ringBuffer* initRingBuffer(uint32_t capacity) {
+    ringBuffer *self = (ringBuffer*) calloc(1, sizeof(ringBuffer));
+
+    if (self == NULL) {
+        return NULL;
+    }
+
+    self->slots = (void**) calloc(capacity, sizeof(void*));
+
+    if (self->slots == NULL) {
+        free(self);
+        return NULL;
+    }
+
+    self->capacity = capacity;
+
+    pthread_mutex_init(&(self->lock), NULL);
+    pthread_cond_init(&(self->notEmpty), NULL);
+    pthread_cond_init(&(self->notFull), NULL);
+
+    return self;
+}
+
+/*
+This function appends <item>, waiting for a free slot. It returns false,
+and drops nothing, if the ring is or gets closed.
+*/
+bool pushRingBuffer(ringBuffer* self, void* item) {
+    bool pushed = false;
+
+    pthread_mutex_lock(&(self->lock));
+
+    while (!self->closed && self->count == self->capacity) {
+        pthread_cond_wait(&(self->notFull), &(self->lock));
+    }
+
+    if (!self->closed) {
+        self->slots[(self->head + self->count) % self->capacity] = item;
+        self->count++;
+        pushed = true;
+        pthread_cond_signal(&(self->notEmpty));
+    }
+
+    pthread_mutex_unlock(&(self->lock));
+
+    return pushed;
+}
+
+/*
+This function removes the oldest item, waiting for one. It returns NULL
+once the ring is closed and empty.
+*/
+void* popRingBuffer(ringBuffer* self) {
+    void *item = NULL;
+
+    pthread_mutex_lock(&(self->lock));
+
+    while (!self->closed && self->count == 0) {
+        pthread_cond_wait(&(self->notEmpty), &(self->lock));
+    }
+
+    if (self->count > 0) {
+        item = self->slots[self->head];
+        self->head = (self->head + 1) % self->capacity;
+        self->count--;
+        pthread_cond_signal(&(self->notFull));
+    }
+
+    pthread_mutex_unlock(&(self->lock));
+
+    return item;
+}
+
+void closeRingBuffer(ringBuffer* self) {
+    pthread_mutex_lock(&(self->lock));
+    self->closed = true;
+    pthread_cond_broadcast(&(self->notEmpty));
+    pthread_cond_broadcast(&(self->notFull));
+    pthread_mutex_unlock(&(self->lock));
+}
+
+void freeRingBuffer(ringBuffer* self) {
+    if (self == NULL) {
+        return;
+    }
+
+    pthread_mutex_destroy(&(self->lock));
+    pthread_cond_destroy(&(self->notEmpty));
+    pthread_cond_destroy(&(self->notFull));
+
+    free(self->slots);
+    free(self);
+}
@@ -0,0 +1,34 @@
+#ifndef RING_BUFFER_H
+#define RING_BUFFER_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+typedef struct ringBuffer ringBuffer;
+
+/*
+A bounded queue of pointers between threads. Pushing blocks while it is
+full and popping blocks while it is empty. Once closed, pushes fail and
+pops return what is left, then NULL, so closing both ends a stream and
+releases every thread waiting on it.
+*/
+struct ringBuffer {
+    void **slots;
+    uint32_t capacity;
+    uint32_t head;
+    uint32_t count;
+    bool closed;
+    pthread_mutex_t lock;
+    pthread_cond_t notEmpty;
+    pthread_cond_t notFull;
+};
+
+ringBuffer* initRingBuffer(uint32_t capacity);
+bool pushRingBuffer(ringBuffer* self, void* item);
+void* popRingBuffer(ringBuffer* self);
+void closeRingBuffer(ringBuffer* self);
+void freeRingBuffer(ringBuffer* self);
+
+#endif
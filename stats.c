@@ -0,0 +1,129 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <time.h>
+#include <sys/resource.h>
+
+#include "stats.h"
+
+static uint64_t readClock(clockid_t);
+
+static const char *stageNames[NUMBER_OF_STAGES] = {
+    "build_queue", "build_tree", "code_table", "encode", "decode_table", "decode", "read", "write"
+};
+
+static uint64_t readClock(clockid_t clock) {
+    struct timespec now;
+
+    clock_gettime(clock, &now);
+
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+/*
+With statistics on, a stage reads the wall clock and the CPU clock of the
+calling thread when it starts and stops; with them off it costs a test.
+*/
+void startStage(const codecStats* self, stageTimer* timer) {
+    if (self->enabled) {
+        timer->wallTime = readClock(CLOCK_MONOTONIC);
+        timer->cpuTime = readClock(CLOCK_THREAD_CPUTIME_ID);
+    }
+}
+
+void stopStage(codecStats* self, uint32_t stage, const stageTimer* timer, uint64_t bytes) {
+    if (self->enabled) {
+        self->stages[stage].calls++;
+        self->stages[stage].wallTime += readClock(CLOCK_MONOTONIC) - timer->wallTime;
+        self->stages[stage].cpuTime += readClock(CLOCK_THREAD_CPUTIME_ID) - timer->cpuTime;
+        self->stages[stage].bytes += bytes;
+    }
+}
+
+/*
+This function clears the counters but leaves statistics on or off.
+*/
+void resetStats(codecStats* self) {
+    *self = (codecStats){.enabled = self->enabled};
+}
+
+void mergeStats(codecStats* self, const codecStats* other) {
+    for (uint32_t i = 0; i < NUMBER_OF_STAGES; ++i) {
+        self->stages[i].calls += other->stages[i].calls;
+        self->stages[i].wallTime += other->stages[i].wallTime;
+        self->stages[i].cpuTime += other->stages[i].cpuTime;
+        self->stages[i].bytes += other->stages[i].bytes;
+    }
+
+    self->blocks += other->blocks;
+    self->treeNodes += other->treeNodes;
+    self->rawBytes += other->rawBytes;
+    self->codedBits += other->codedBits;
+    self->exactBits += other->exactBits;
+    self->entropyBits += other->entropyBits;
+}
+
+/*
+Whole operations are timed with the CPU time of the process, which covers
+every thread.
+*/
+void startTimer(stageTimer* timer) {
+    timer->wallTime = readClock(CLOCK_MONOTONIC);
+    timer->cpuTime = readClock(CLOCK_PROCESS_CPUTIME_ID);
+}
+
+/*
+The wall time since <timer> was started, in seconds.
+*/
+double elapsedSeconds(const stageTimer* timer) {
+    return (readClock(CLOCK_MONOTONIC) - timer->wallTime) / 1e9;
+}
+
+/*
+This function writes the statistics of an operation started at <timer>
+as a single line of JSON. Times are in seconds, the peak memory is the
+resident set of the process, and the entropy is only known when
+compressing. The sampling loss is the share of bits a sampled table
+spent over the tables of the blocks' own counts.
+*/
+bool printStats(const codecStats* self, const char* operation, uint32_t threads,
+                const stageTimer* timer, FILE* dstFile) {
+    struct rusage usage;
+    uint64_t wallTime = readClock(CLOCK_MONOTONIC) - timer->wallTime;
+    uint64_t cpuTime = readClock(CLOCK_PROCESS_CPUTIME_ID) - timer->cpuTime;
+    uint64_t peakMemory = 0;
+    double rawBytes = (self->rawBytes > 0) ? (double)self->rawBytes : 1.0;
+
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        /* kilobytes on Linux */
+        peakMemory = (uint64_t)usage.ru_maxrss * 1024u;
+    }
+
+    fprintf(dstFile, "{\"operation\":\"%s\",\"threads\":%u,\"wall_seconds\":%.6f,\"cpu_seconds\":%.6f,"
+                     "\"peak_memory_bytes\":%llu,\"stages\":{",
+            operation, threads, wallTime / 1e9, cpuTime / 1e9, (unsigned long long)peakMemory);
+
+    for (uint32_t i = 0; i < NUMBER_OF_STAGES; ++i) {
+        fprintf(dstFile, "%s\"%s\":{\"calls\":%llu,\"wall_seconds\":%.6f,\"cpu_seconds\":%.6f,\"bytes\":%llu}",
+                (i > 0) ? "," : "", stageNames[i], (unsigned long long)self->stages[i].calls,
+                self->stages[i].wallTime / 1e9, self->stages[i].cpuTime / 1e9,
+                (unsigned long long)self->stages[i].bytes);
+    }
+
+    fprintf(dstFile, "},\"blocks\":%llu,\"tree_nodes\":%llu,\"raw_bytes\":%llu,\"average_code_length\":%.4f,",
+            (unsigned long long)self->blocks, (unsigned long long)self->treeNodes,
+            (unsigned long long)self->rawBytes, self->codedBits / rawBytes);
+
+    if (self->exactBits > 0) {
+        fprintf(dstFile, "\"sampling_loss\":%.4f,", (double)self->codedBits / self->exactBits - 1.0);
+    } else {
+        fprintf(dstFile, "\"sampling_loss\":null,");
+    }
+
+    if (self->stages[STAGE_BUILD_QUEUE].calls > 0) {
+        fprintf(dstFile, "\"entropy\":%.4f}\n", self->entropyBits / rawBytes);
+    } else {
+        fprintf(dstFile, "\"entropy\":null}\n");
+    }
+
+    return !ferror(dstFile);
+}
@@ -0,0 +1,66 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define STAGE_BUILD_QUEUE 0
+#define STAGE_BUILD_TREE 1
+#define STAGE_CODE_TABLE 2
+#define STAGE_ENCODE 3
+#define STAGE_DECODE_TABLE 4
+#define STAGE_DECODE 5
+#define STAGE_READ 6
+#define STAGE_WRITE 7
+#define NUMBER_OF_STAGES 8
+
+typedef struct stageStats stageStats;
+typedef struct stageTimer stageTimer;
+typedef struct codecStats codecStats;
+
+/*
+Totals of one stage over an operation: how often it ran, its wall and CPU
+time summed over all threads and the bytes it went through.
+*/
+struct stageStats {
+    uint64_t calls;
+    uint64_t wallTime;
+    uint64_t cpuTime;
+    uint64_t bytes;
+};
+
+struct stageTimer {
+    uint64_t wallTime;
+    uint64_t cpuTime;
+};
+
+/*
+Every context collects its own statistics while <enabled> is set, so
+threads never share counters; worker contexts are merged into their owner
+when an operation ends. <codedBits> and <entropyBits> are summed over the
+blocks, so their ratio to <rawBytes> gives bits per symbol. A sampled
+compression also sums in <exactBits> what the blocks would have cost with
+tables of their own.
+*/
+struct codecStats {
+    bool enabled;
+    stageStats stages[NUMBER_OF_STAGES];
+    uint64_t blocks;
+    uint64_t treeNodes;
+    uint64_t rawBytes;
+    uint64_t codedBits;
+    uint64_t exactBits;
+    double entropyBits;
+};
+
+void startStage(const codecStats* self, stageTimer* timer);
+void stopStage(codecStats* self, uint32_t stage, const stageTimer* timer, uint64_t bytes);
+void resetStats(codecStats* self);
+void mergeStats(codecStats* self, const codecStats* other);
+void startTimer(stageTimer* timer);
+double elapsedSeconds(const stageTimer* timer);
+bool printStats(const codecStats* self, const char* operation, uint32_t threads,
+                const stageTimer* timer, FILE* dstFile);
+
+#endif
@@ -0,0 +1,123 @@
+#include "thread_pool.h"
+
+static void* workerLoop(void*);
+
+static void* workerLoop(void* arg) {
+    threadPoolWorker *worker = (threadPoolWorker*) arg;
+    threadPool *self = worker->pool;
+    uint32_t job;
+
+    pthread_mutex_lock(&(self->lock));
+
+    for (;;) {
+        while (!self->shutdown && self->nextJob >= self->numberOfJobs) {
+            pthread_cond_wait(&(self->jobsReady), &(self->lock));
+        }
+
+        if (self->shutdown) {
+            break;
+        }
+
+        job = self->nextJob++;
+
+        pthread_mutex_unlock(&(self->lock));
+        self->task(self->arg, worker->index, job);
+        pthread_mutex_lock(&(self->lock));
+
+        if (++(self->finishedJobs) == self->numberOfJobs) {
+            pthread_cond_signal(&(self->jobsDone));
+        }
+    }
+
+    pthread_mutex_unlock(&(self->lock));
+
+    return NULL;
+}
+
+/*
+This function hands jobs 0..<numberOfJobs> - 1 out to the workers in
+order and returns once all of them have finished.
+*/
+void runThreadPool(threadPool* self, threadPoolTask task, void* arg, uint32_t numberOfJobs) {
+    if (numberOfJobs == 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&(self->lock));
+
+    self->task = task;
+    self->arg = arg;
+    self->nextJob = 0;
+    self->finishedJobs = 0;
+    self->numberOfJobs = numberOfJobs;
+
+    pthread_cond_broadcast(&(self->jobsReady));
+
+    while (self->finishedJobs < self->numberOfJobs) {
+        pthread_cond_wait(&(self->jobsDone), &(self->lock));
+    }
+
+    pthread_mutex_unlock(&(self->lock));
+}
+
+threadPool* initThreadPool(uint32_t numberOfThreads) {
+    threadPool *self = (threadPool*) calloc(1, sizeof(threadPool));
+
+    if (self == NULL) {
+        return NULL;
+    }
+
+    self->threads = (pthread_t*) calloc(numberOfThreads, sizeof(pthread_t));
+    self->workers = (threadPoolWorker*) calloc(numberOfThreads, sizeof(threadPoolWorker));
+
+    if (self->threads == NULL || self->workers == NULL) {
+        free(self->threads);
+        free(self->workers);
+        free(self);
+        return NULL;
+    }
+
+    pthread_mutex_init(&(self->lock), NULL);
+    pthread_cond_init(&(self->jobsReady), NULL);
+    pthread_cond_init(&(self->jobsDone), NULL);
+
+    for (uint32_t i = 0; i < numberOfThreads; ++i) {
+        self->workers[i] = (threadPoolWorker){self, i};
+
+        if (pthread_create(&(self->threads[i]), NULL, workerLoop, &(self->workers[i])) != 0) {
+            break;
+        }
+
+        self->numberOfThreads++;
+    }
+
+    if (self->numberOfThreads == 0) {
+        freeThreadPool(self);
+        return NULL;
+    }
+
+    return self;
+}
+
+void freeThreadPool(threadPool* self) {
+    if (self == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&(self->lock));
+    self->shutdown = true;
+    pthread_cond_broadcast(&(self->jobsReady));
+    pthread_mutex_unlock(&(self->lock));
+
+    for (uint32_t i = 0; i < self->numberOfThreads; ++i) {
+        pthread_join(self->threads[i], NULL);
+    }
+
+    pthread_mutex_destroy(&(self->lock));
+    pthread_cond_destroy(&(self->jobsReady));
+    pthread_cond_destroy(&(self->jobsDone));
+
+    free(self->threads);
+    free(self->workers);
+    free(self);
+}
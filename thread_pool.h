@@ -0,0 +1,42 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+typedef struct threadPool threadPool;
+typedef struct threadPoolWorker threadPoolWorker;
+
+/*
+A task is called once for every job of a run. <worker> is the index of
+the thread that runs it, so tasks can keep per-thread state in arrays.
+*/
+typedef void (*threadPoolTask)(void* arg, uint32_t worker, uint32_t job);
+
+struct threadPoolWorker {
+    threadPool *pool;
+    uint32_t index;
+};
+
+struct threadPool {
+    pthread_t *threads;
+    threadPoolWorker *workers;
+    uint32_t numberOfThreads;
+    pthread_mutex_t lock;
+    pthread_cond_t jobsReady;
+    pthread_cond_t jobsDone;
+    threadPoolTask task;
+    void *arg;
+    uint32_t numberOfJobs;
+    uint32_t nextJob;
+    uint32_t finishedJobs;
+    bool shutdown;
+};
+
+threadPool* initThreadPool(uint32_t numberOfThreads);
+void runThreadPool(threadPool* self, threadPoolTask task, void* arg, uint32_t numberOfJobs);
+void freeThreadPool(threadPool* self);
+
+#endif